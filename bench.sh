@@ -0,0 +1,17 @@
+#!/bin/bash
+
+echo "Building FileOrganizer benchmark..." >&2
+
+mkdir -p build
+
+# Same flags as run.sh, so the numbers match the shipped binary
+g++ -std=c++17 -pthread -static-libgcc -static-libstdc++ -O2 -Wall -Wextra -o build/FileOrganizerBench src/benchmark.cpp
+
+if [ $? -ne 0 ]; then
+    echo "✗ Benchmark build failed!" >&2
+    exit 1
+fi
+
+# Results are JSON lines on stdout; pass --out FILE to append them to a file.
+# Example: ./bench.sh --files 10000,100000,1000000 --jobs 4 --out build/bench.jsonl
+./build/FileOrganizerBench "$@"
@@ -7,7 +7,7 @@ if not exist build mkdir build
 
 REM Compile with static linking to avoid dynamic library issues
 echo Compiling FileOrganizer...
-g++ -std=c++17 -static-libgcc -static-libstdc++ -o build/FileOrganizer.exe src/fileorganizer.cpp
+g++ -std=c++17 -pthread -static-libgcc -static-libstdc++ -o build/FileOrganizer.exe src/fileorganizer.cpp
 
 REM Check if compilation was successful
 if %errorlevel% equ 0 (
@@ -16,7 +16,7 @@ else
     EXECUTABLE="build/FileOrganizer"
 fi
 
-g++ -std=c++17 -static-libgcc -static-libstdc++ -O2 -Wall -Wextra -o "$EXECUTABLE" src/fileorganizer.cpp
+g++ -std=c++17 -pthread -static-libgcc -static-libstdc++ -O2 -Wall -Wextra -o "$EXECUTABLE" src/fileorganizer.cpp
 
 # Check if compilation was successful
 if [ $? -eq 0 ]; then
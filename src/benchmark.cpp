@@ -0,0 +1,428 @@
+/*
+ * FileOrganizer - Benchmark harness
+ *
+ * MIT License
+ * Copyright (c) 2025 FileOrganizer Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Generates synthetic folders and times listFiles, organizeFolder,
+// showUndoHistory and undoOrganization on them in process, one JSON object
+// per line and operation. Built and run by bench.sh.
+
+#define FILEORGANIZER_NO_MAIN
+#include "fileorganizer.cpp"
+
+#include <random>
+
+// Shape of a synthetic folder
+struct TreeSpec {
+    size_t files = 10000;
+    int depth = 0;                  // Levels of nested folders (0 = all files at the top)
+    int fanout = 8;                 // Sub-folders per nested folder
+    double duplicateRate = 0.1;     // Share of files whose name is already taken in the target folder
+    std::uintmax_t fileSize = 0;    // Bytes written to every file
+    std::vector<std::pair<std::string, double>> extensions = {
+        {"jpg", 30}, {"png", 10}, {"mp4", 5}, {"mp3", 10}, {"pdf", 15},
+        {"docx", 10}, {"txt", 10}, {"zip", 5}, {"bin", 5}};
+    unsigned seed = 42;
+};
+
+// Builds the folder described by spec under root. Duplicate names collide
+// the way real drops do: in a flat folder a copy already waits in the
+// category folder, in a nested tree the same name appears in several
+// sub-folders.
+bool generateTree(const fs::path& root, const TreeSpec& spec) {
+    std::error_code ec;
+    fs::create_directories(root, ec);
+    if (ec) {
+        std::cerr << "Error: cannot create " << root.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::vector<fs::path> folders{root};
+    for (size_t level = 0, first = 0; static_cast<int>(level) < spec.depth; ++level) {
+        size_t last = folders.size();
+        for (size_t parent = first; parent < last; ++parent) {
+            for (int child = 0; child < spec.fanout; ++child) {
+                folders.push_back(folders[parent] / ("dir" + std::to_string(child)));
+                fs::create_directory(folders.back(), ec);
+            }
+        }
+        first = last;
+    }
+
+    std::mt19937 random(spec.seed);
+    std::vector<double> weights;
+    for (const auto& extension : spec.extensions) {
+        weights.push_back(extension.second);
+    }
+    std::discrete_distribution<size_t> pickExtension(weights.begin(), weights.end());
+    std::uniform_int_distribution<size_t> pickFolder(0, folders.size() - 1);
+    std::bernoulli_distribution isDuplicate(spec.duplicateRate);
+    // About four files share each duplicated name
+    size_t sharedNames = std::max<size_t>(1, static_cast<size_t>(spec.files * spec.duplicateRate / 4));
+    std::uniform_int_distribution<size_t> pickShared(0, sharedNames - 1);
+    std::string contents(static_cast<size_t>(spec.fileSize), 'x');
+
+    auto write = [&](const fs::path& path) {
+        std::ofstream file(path, std::ios::binary);
+        file.write(contents.data(), contents.size());
+        return static_cast<bool>(file);
+    };
+
+    for (size_t i = 0; i < spec.files; ++i) {
+        const std::string& extension = spec.extensions[pickExtension(random)].first;
+        fs::path folder = folders[pickFolder(random)];
+        if (!isDuplicate(random)) {
+            if (!write(folder / ("file_" + std::to_string(i) + "." + extension))) {
+                std::cerr << "Error: cannot write into " << folder.string() << std::endl;
+                return false;
+            }
+            continue;
+        }
+
+        std::string name = "IMG_" + std::to_string(pickShared(random)) + "." + extension;
+        if (spec.depth == 0) {
+            // A copy already waits in the category folder, as after an earlier run
+            name = "IMG_" + std::to_string(i) + "." + extension;
+            fs::path categoryFolder = root / categoryName(ExtensionTable::lookup(extension));
+            fs::create_directory(categoryFolder, ec);
+            write(categoryFolder / name);
+        } else if (fs::exists(folder / name, ec)) {
+            name = "IMG_" + std::to_string(i) + "." + extension;
+        }
+        if (!write(folder / name)) {
+            std::cerr << "Error: cannot write into " << folder.string() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Per-file latencies, taken as the time between two files finishing on
+// the same worker thread (the first file counts from the start of the run).
+// That only measures per-file work when callbacks follow the work itself,
+// as moves and restores do; list results arrive after the whole scan.
+class LatencyRecorder : public OrganizerObserver {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.clear();
+        generation = nextGeneration++;
+        started = Clock::now();
+    }
+
+    void onListed(const std::string&, const std::string&, std::uintmax_t) override {
+        record();
+    }
+
+    void onMoved(const std::string&, const std::string&) override {
+        record();
+    }
+
+    std::vector<double> samples() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<double> all;
+        for (const auto& thread : threads) {
+            all.insert(all.end(), thread->samples.begin(), thread->samples.end());
+        }
+        return all;
+    }
+
+private:
+    struct ThreadSamples {
+        Clock::time_point last;
+        std::vector<double> samples;   // Microseconds
+    };
+
+    // Each thread finds its own sample list once per run, so recording is
+    // lock-free. Generations are unique across recorders, so a thread never
+    // mistakes its list from an earlier (since destroyed) recorder for one
+    // of this run.
+    void record() {
+        thread_local ThreadSamples* mine = nullptr;
+        thread_local std::uint64_t mineGeneration = 0;
+        if (!mine || mineGeneration != generation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(std::make_unique<ThreadSamples>());
+            mine = threads.back().get();
+            mine->last = started;
+            mineGeneration = generation;
+        }
+        Clock::time_point now = Clock::now();
+        mine->samples.push_back(std::chrono::duration<double, std::micro>(now - mine->last).count());
+        mine->last = now;
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadSamples>> threads;
+    std::atomic<std::uint64_t> generation{0};
+    Clock::time_point started;
+    
+    inline static std::atomic<std::uint64_t> nextGeneration{1};
+};
+
+double percentile(std::vector<double>& values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t rank = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+struct BenchResult {
+    std::string medium;
+    std::string operation;
+    size_t files;
+    double seconds;
+    std::vector<double> latencies;   // Microseconds
+};
+
+void printResult(std::ostream& out, BenchResult& result, const TreeSpec& spec, const OrganizerOptions& options) {
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3)
+         << "{\"medium\":" << JsonValue::quote(result.medium)
+         << ",\"operation\":" << JsonValue::quote(result.operation)
+         << ",\"files\":" << result.files
+         << ",\"depth\":" << spec.depth
+         << ",\"duplicate_rate\":" << spec.duplicateRate
+         << ",\"jobs\":" << options.jobs
+         << ",\"seconds\":" << result.seconds
+         << ",\"files_per_second\":" << (result.seconds > 0 ? result.files / result.seconds : 0)
+         << ",\"samples\":" << result.latencies.size();
+    if (result.latencies.empty()) {
+        line << ",\"p50_us\":null,\"p99_us\":null}";
+    } else {
+        line << ",\"p50_us\":" << percentile(result.latencies, 0.50)
+             << ",\"p99_us\":" << percentile(result.latencies, 0.99) << "}";
+    }
+    out << line.str() << std::endl;
+}
+
+// Times every operation once on a freshly generated folder under root
+bool runBenchmark(const std::string& medium, const fs::path& root, const TreeSpec& spec, OrganizerOptions options,
+                  int historyRepeats, std::ostream& out) {
+    fs::path folder = root / ("fileorganizer-bench-" + std::to_string(spec.files));
+    std::error_code ec;
+    fs::remove_all(folder, ec);
+    if (!generateTree(folder, spec)) {
+        return false;
+    }
+
+    options.recursive = spec.depth > 0;
+    std::ostream quiet(nullptr);
+    LatencyRecorder recorder;
+    SimpleFileOrganizer organizer;
+    organizer.setOptions(options);
+    organizer.setOutput(quiet);
+    organizer.setObserver(&recorder);
+
+    // perFile: whether the recorder's gaps are per-file latencies
+    auto time = [&](const std::string& operation, bool perFile, auto run) {
+        recorder.start();
+        auto started = LatencyRecorder::Clock::now();
+        run();
+        BenchResult result{medium, operation, spec.files,
+                           std::chrono::duration<double>(LatencyRecorder::Clock::now() - started).count(),
+                           perFile ? recorder.samples() : std::vector<double>()};
+        printResult(out, result, spec, options);
+    };
+
+    // Listed files are reported after the scan, so list has no per-file latency
+    std::string path = folder.string();
+    time("list", false, [&] { organizer.listFiles(path); });
+    time("list_cached", false, [&] { organizer.listFiles(path); });
+    time("organize", true, [&] { organizer.organizeFolder(path); });
+
+    // History is a single quick read, so it is repeated for its latencies
+    recorder.start();
+    std::vector<double> historyLatencies;
+    auto started = LatencyRecorder::Clock::now();
+    for (int i = 0; i < historyRepeats; ++i) {
+        auto call = LatencyRecorder::Clock::now();
+        organizer.showUndoHistory(path);
+        historyLatencies.push_back(std::chrono::duration<double, std::micro>(LatencyRecorder::Clock::now() - call).count());
+    }
+    BenchResult history{medium, "history", static_cast<size_t>(historyRepeats),
+                        std::chrono::duration<double>(LatencyRecorder::Clock::now() - started).count(),
+                        historyLatencies};
+    printResult(out, history, spec, options);
+
+    time("undo", true, [&] { organizer.undoOrganization(path); });
+
+    fs::remove_all(folder, ec);
+    return true;
+}
+
+bool parseExtensionMix(const std::string& value, std::vector<std::pair<std::string, double>>& extensions) {
+    extensions.clear();
+    std::istringstream entries(value);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        size_t colon = entry.find(':');
+        std::string extension = entry.substr(0, colon);
+        double weight = colon == std::string::npos ? 1 : std::atof(entry.c_str() + colon + 1);
+        if (extension.empty() || weight <= 0) {
+            return false;
+        }
+        extensions.emplace_back(extension, weight);
+    }
+    return !extensions.empty();
+}
+
+void showBenchHelp() {
+    std::cout << "FileOrganizer benchmark" << std::endl;
+    std::cout << std::endl;
+    std::cout << "USAGE: FileOrganizerBench [OPTIONS]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --files <N[,N...]>          Files per generated folder (default: 10000)" << std::endl;
+    std::cout << "  --depth <N>                 Levels of nested folders; > 0 benchmarks --recursive (default: 0)" << std::endl;
+    std::cout << "  --fanout <N>                Sub-folders per nested folder (default: 8)" << std::endl;
+    std::cout << "  --dup-rate <0..1>           Share of files whose name collides in the target (default: 0.1)" << std::endl;
+    std::cout << "  --ext <ext:weight,...>      Extension distribution (default: jpg:30,png:10,mp4:5,...)" << std::endl;
+    std::cout << "  --size <bytes>              Size of every generated file (default: 0)" << std::endl;
+    std::cout << "  --root <label=path>         Where to generate folders; repeatable" << std::endl;
+    std::cout << "                              (default: tmpfs=/dev/shm and disk=build)" << std::endl;
+    std::cout << "  --history-repeats <N>       Timed --history calls per run (default: 200)" << std::endl;
+    std::cout << "  --out <file>                Append results to a file instead of stdout" << std::endl;
+    std::cout << "  --generate <path>           Only generate a folder at path and exit" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --jobs, --io-uring, --write-ahead, --fsync, --sniff and --rules are passed to the organizer." << std::endl;
+    std::cout << std::endl;
+    std::cout << "Each operation prints one JSON object per line: medium, operation, files, seconds," << std::endl;
+    std::cout << "files_per_second, p50_us and p99_us (per-file latency; per call for history," << std::endl;
+    std::cout << "null for list, whose files are only reported once the scan is done)." << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    TreeSpec spec;
+    std::vector<size_t> fileCounts;
+    std::vector<std::pair<std::string, std::string>> roots;
+    OrganizerOptions options;
+    int historyRepeats = 200;
+    std::string outPath;
+    std::string generatePath;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        bool takesValue = true;
+        if (arg == "--help") {
+            showBenchHelp();
+            return 0;
+        } else if (arg == "--files") {
+            std::istringstream counts(value);
+            std::string count;
+            while (std::getline(counts, count, ',')) {
+                fileCounts.push_back(std::strtoull(count.c_str(), nullptr, 10));
+            }
+        } else if (arg == "--depth") {
+            spec.depth = std::atoi(value.c_str());
+        } else if (arg == "--fanout") {
+            spec.fanout = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--dup-rate") {
+            spec.duplicateRate = std::min(1.0, std::max(0.0, std::atof(value.c_str())));
+        } else if (arg == "--ext") {
+            if (!parseExtensionMix(value, spec.extensions)) {
+                std::cerr << "Error: --ext expects ext:weight pairs, e.g. jpg:3,pdf:1" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--size") {
+            spec.fileSize = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--root") {
+            size_t equals = value.find('=');
+            roots.emplace_back(equals == std::string::npos ? value : value.substr(0, equals),
+                               equals == std::string::npos ? value : value.substr(equals + 1));
+        } else if (arg == "--history-repeats") {
+            historyRepeats = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--out") {
+            outPath = value;
+        } else if (arg == "--generate") {
+            generatePath = value;
+        } else if (arg == "--jobs") {
+            if (!parseCountOption(value, options.jobs)) {
+                std::cerr << "Error: --jobs expects a number of worker threads." << std::endl;
+                return 1;
+            }
+        } else if (arg == "--fsync") {
+            options.fsyncPolicy = value == "never" ? FsyncPolicy::never
+                                : value == "session" ? FsyncPolicy::session : FsyncPolicy::batch;
+        } else if (arg == "--rules") {
+            options.rulesFile = value;
+        } else {
+            takesValue = false;
+            if (arg == "--io-uring") {
+                options.ioUring = true;
+            } else if (arg == "--write-ahead") {
+                options.writeAhead = true;
+            } else if (arg == "--sniff") {
+                options.sniff = true;
+            } else {
+                std::cerr << "Error: unknown option " << arg << " (see --help)" << std::endl;
+                return 1;
+            }
+        }
+        if (takesValue) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " expects a value." << std::endl;
+                return 1;
+            }
+            ++i;
+        }
+    }
+
+    if (fileCounts.empty()) {
+        fileCounts.push_back(spec.files);
+    }
+    if (!generatePath.empty()) {
+        spec.files = fileCounts.front();
+        return generateTree(generatePath, spec) ? 0 : 1;
+    }
+    if (roots.empty()) {
+        if (fs::is_directory("/dev/shm")) {
+            roots.emplace_back("tmpfs", "/dev/shm");
+        }
+        roots.emplace_back("disk", "build");
+    }
+
+    std::ofstream outFile;
+    if (!outPath.empty()) {
+        outFile.open(outPath, std::ios::app);
+        if (!outFile) {
+            std::cerr << "Error: cannot write " << outPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : outFile;
+
+    for (size_t files : fileCounts) {
+        spec.files = files;
+        for (const auto& root : roots) {
+            if (!runBenchmark(root.first, root.second, spec, options, historyRepeats, out)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
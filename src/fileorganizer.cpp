@@ -25,6 +25,7 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <filesystem>
 #include <vector>
 #include <map>
@@ -33,449 +34,7622 @@
 #include <fstream>
 #include <ctime>
 #include <unordered_map>
+#include <unordered_set>
 #include <iomanip>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <csignal>
+#include <deque>
+#include <memory>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <chrono>
+#include <limits>
+#include <bitset>
+#include <functional>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define FILEORGANIZER_HAVE_IO_URING 1
+#endif
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
 
 namespace fs = std::filesystem;
 
-// Structure to track file movements for undo functionality
+#ifdef _WIN32
+constexpr std::string_view pathSeparators = "/\\";
+#else
+constexpr std::string_view pathSeparators = "/";
+#endif
+
+// Splits a path into its folder and file name at the last separator
+constexpr std::pair<std::string_view, std::string_view> splitPath(std::string_view path) {
+    size_t separator = path.find_last_of(pathSeparators);
+    if (separator == std::string_view::npos) {
+        return {std::string_view(), path};
+    }
+    return {path.substr(0, separator == 0 ? 1 : separator), path.substr(separator + 1)};
+}
+
+// A path's text, without a copy where the native encoding is already narrow
+#ifdef _WIN32
+inline std::string pathText(const fs::path& path) { return path.string(); }
+#else
+inline const std::string& pathText(const fs::path& path) { return path.native(); }
+#endif
+
+std::string joinPath(std::string_view folder, std::string_view name) {
+    std::string path;
+    path.reserve(folder.size() + name.size() + 1);
+    path += folder;
+    if (!folder.empty() && pathSeparators.find(folder.back()) == std::string_view::npos) {
+        path += '/';
+    }
+    path += name;
+    return path;
+}
+
+// Bump allocator for path text. Copies are packed into 64 KB blocks that
+// never move, so the views it hands out stay valid for the arena's
+// lifetime, and a million file names cost a few hundred allocations rather
+// than a million. Not thread-safe: each worker fills its own arena and hands
+// it over with adopt() when done.
+class PathArena {
+public:
+    PathArena() = default;
+    PathArena(PathArena&&) = default;
+    PathArena& operator=(PathArena&&) = default;
+    
+    // Copies text into the arena. The copy is NUL-terminated, so its data()
+    // can be passed straight to system calls.
+    std::string_view store(std::string_view text) {
+        char* copy = allocate(text.size() + 1);
+        if (!text.empty()) {
+            std::memcpy(copy, text.data(), text.size());
+        }
+        copy[text.size()] = '\0';
+        return std::string_view(copy, text.size());
+    }
+    
+    // Stores folder + "/" + name as one NUL-terminated path
+    std::string_view join(std::string_view folder, std::string_view name) {
+        bool separate = !folder.empty() && pathSeparators.find(folder.back()) == std::string_view::npos;
+        size_t length = folder.size() + (separate ? 1 : 0) + name.size();
+        char* copy = allocate(length + 1);
+        if (!folder.empty()) {
+            std::memcpy(copy, folder.data(), folder.size());
+        }
+        if (separate) {
+            copy[folder.size()] = '/';
+        }
+        if (!name.empty()) {
+            std::memcpy(copy + length - name.size(), name.data(), name.size());
+        }
+        copy[length] = '\0';
+        return std::string_view(copy, length);
+    }
+    
+    // Takes over another arena's blocks; views into them stay valid
+    void adopt(PathArena&& other) {
+        for (auto& block : other.blocks) {
+            insertBlock(std::move(block));
+        }
+        other.blocks.clear();
+        other.cursor = nullptr;
+        other.left = 0;
+    }
+
+private:
+    static const size_t blockSize = 64 * 1024;
+    
+    std::vector<std::unique_ptr<char[]>> blocks;   // The block being filled, if any, is always last
+    char* cursor = nullptr;
+    size_t left = 0;
+    
+    char* allocate(size_t size) {
+        if (size > left) {
+            if (size > blockSize / 4) {
+                // Long text gets a block of its own, leaving the current one in use
+                return insertBlock(std::make_unique<char[]>(size));
+            }
+            blocks.push_back(std::make_unique<char[]>(blockSize));
+            cursor = blocks.back().get();
+            left = blockSize;
+        }
+        char* result = cursor;
+        cursor += size;
+        left -= size;
+        return result;
+    }
+    
+    char* insertBlock(std::unique_ptr<char[]> block) {
+        auto position = cursor ? blocks.end() - 1 : blocks.end();
+        return blocks.insert(position, std::move(block))->get();
+    }
+};
+
+// One moved file, as recorded for undo. Every view points into the
+// session's PathPool: both folders are interned, so a folder's path is
+// stored once however many files move in or out of it, and newName is the
+// very same view as name unless the file had to be renamed on the way.
 struct FileMove {
-    std::string originalPath;
-    std::string newPath;
-    std::string timestamp;
+    std::string_view originalFolder;
+    std::string_view name;
+    std::string_view newFolder;
+    std::string_view newName;
+    bool linked = false;   // The new path was then replaced by a hard link to an identical file (--dedupe link)
+    std::uint64_t size = unknownSize;   // Bytes moved, taken just before the move
+    
+    static constexpr std::uint64_t unknownSize = ~std::uint64_t(0);   // Journals written before sizes were kept
+    
+    std::string originalPath() const { return joinPath(originalFolder, name); }
+    std::string newPath() const { return joinPath(newFolder, newName); }
 };
 
-class SimpleFileOrganizer {
+// Owns the path text of one organize or undo session. Folder paths are
+// interned; everything else is bump-allocated. Safe to share between
+// workers, which intern folders rarely (once per folder they touch) and
+// fill arenas of their own for file names.
+class PathPool {
+public:
+    PathPool() = default;
+    PathPool(const PathPool&) = delete;
+    PathPool& operator=(const PathPool&) = delete;
+    
+    // The pool's single copy of a folder path
+    std::string_view folder(std::string_view path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = folders.find(path);
+        if (found != folders.end()) {
+            return *found;
+        }
+        return *folders.insert(arena.store(path)).first;
+    }
+    
+    std::string_view store(std::string_view text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return arena.store(text);
+    }
+    
+    void adopt(PathArena&& other) {
+        std::lock_guard<std::mutex> lock(mutex);
+        arena.adopt(std::move(other));
+    }
+    
+    // A move record for two full paths, as read back from a journal
+    FileMove record(std::string_view originalPath, std::string_view newPath) {
+        auto [originalFolder, name] = splitPath(originalPath);
+        auto [newFolder, newName] = splitPath(newPath);
+        FileMove move;
+        move.originalFolder = folder(originalFolder);
+        move.name = store(name);
+        move.newFolder = folder(newFolder);
+        move.newName = newName == name ? move.name : store(newName);
+        return move;
+    }
+
 private:
-    std::map<std::string, std::string> extensionCategories = {
-        // Images
-        {".jpg", "Images"}, {".jpeg", "Images"}, {".png", "Images"}, 
-        {".gif", "Images"}, {".bmp", "Images"}, {".tiff", "Images"},
-        {".svg", "Images"}, {".webp", "Images"}, {".ico", "Images"},
-        
-        // Audio
-        {".mp3", "Music"}, {".wav", "Music"}, {".flac", "Music"}, 
-        {".aac", "Music"}, {".ogg", "Music"}, {".wma", "Music"},
-        {".m4a", "Music"}, {".opus", "Music"},
-        
-        // Video
-        {".mp4", "Videos"}, {".avi", "Videos"}, {".mkv", "Videos"}, 
-        {".mov", "Videos"}, {".wmv", "Videos"}, {".flv", "Videos"},
-        {".webm", "Videos"}, {".m4v", "Videos"}, {".3gp", "Videos"},
-        
-        // Documents
-        {".pdf", "Documents"}, {".doc", "Documents"}, {".docx", "Documents"}, 
-        {".txt", "Documents"}, {".rtf", "Documents"}, {".odt", "Documents"},
-        {".xls", "Documents"}, {".xlsx", "Documents"}, {".ppt", "Documents"}, 
-        {".pptx", "Documents"}, {".csv", "Documents"}, {".md", "Documents"}
+    std::mutex mutex;
+    PathArena arena;
+    std::unordered_set<std::string_view> folders;
+};
+
+// A byte-identical file found by --dedupe and what was done with it
+struct DuplicateAction {
+    enum Kind : std::uint32_t {
+        linked = 1,    // Moved, then replaced by a hard link to the kept copy
+        skipped = 2    // Left where it was
     };
+    Kind kind;
+    std::string path;       // Where the duplicate is now
+    std::string keptPath;   // The copy that was kept
+};
+
+// What --dedupe does with a file identical to one already organized
+enum class DedupeMode {
+    off,
+    link,   // Hard-link it to the kept copy, freeing its space
+    skip    // Leave it unorganized where it is
+};
+
+// When the write-ahead undo journal forces its records to stable storage
+enum class FsyncPolicy {
+    never,     // Leave flushing to the operating system
+    batch,     // fsync every group commit, before the batch's renames run
+    session    // fsync once when the session finishes
+};
+
+// How files are arranged inside their category folder
+enum class FolderLayout {
+    flat,   // Directly in the category folder
+    date    // Photos and videos in <year>/<month> subfolders by capture date
+};
+
+// A year or month folder of FolderLayout::date
+inline bool isDateLevel(std::string_view name) {
+    return (name.size() == 2 || name.size() == 4) &&
+           std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); });
+}
+
+// Runtime options shared by the command-line and interactive front ends
+struct OrganizerOptions {
+    int jobs = 1;             // Worker threads used for moving files (0 = one per core)
+    bool recursive = false;   // Walk nested folders instead of only the top level
+    bool ioUring = false;     // Batch renames/mkdirs through io_uring when the kernel supports it
+    bool writeAhead = false;  // Stream undo records to the journal while files are moved
+    FsyncPolicy fsyncPolicy = FsyncPolicy::batch;
+    bool sniff = false;       // Classify by file content (magic bytes) before extension
+    std::string rulesFile;    // User-defined rules, tried before the built-in categories
+    DedupeMode dedupe = DedupeMode::off;
+    std::string targetRoot;   // Where category folders go (default: inside the organized folder)
+    FolderLayout layout = FolderLayout::flat;
+};
 
+// Run statistics for --stats, --stats-json and --trace. Each thread counts
+// into its own block, found through a thread_local pointer, so the hot
+// paths take no locks and share no cache lines; blocks are only merged for
+// the report. While statistics are off every hook is a single branch.
+class RunStats {
 public:
-    void listFiles(const std::string& folderPath) {
-        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
-            std::cout << "Error: Folder does not exist: " << folderPath << std::endl;
-            return;
+    using Clock = std::chrono::steady_clock;
+    
+    enum Phase : int {
+        phaseReadDirectory,   // One getdents64 call (or directory iteration)
+        phaseNameIndex,       // Reading a target folder's names for conflict resolution
+        phaseMkdir,           // Creating the category folders
+        phaseSniff,           // Content sniffing of a whole run
+        phaseMetadata,        // Capture dates of a whole run (--layout date)
+        phaseDedupe,          // Duplicate search of a whole run
+        phaseMoveBatch,       // One batch of moves (with its journal records) or of restores
+        phaseRename,          // One rename(2)/renameat2(2)
+        phaseCopy,            // One cross-device copy
+        phaseJournal,         // One undo journal write
+        phaseRestore,         // One file restored by --undo
+        phaseCount
+    };
+    
+    enum Counter : int {
+        counterStat,            // stat/statx/fstatat calls
+        counterGetdents,        // Directory reads
+        counterRename,          // Rename attempts
+        counterRenameConflict,  // Renames refused because the name was taken
+        counterNameProbe,       // Names tried before a free "stem_N.ext" was found
+        counterCrossDevice,     // Files copied to another file system
+        counterRingSubmit,      // io_uring submissions
+        counterJournalBytes,    // Bytes written to the undo journal
+        counterFsync,           // fsync calls
+        counterCount
+    };
+    
+    static void enable(bool trace) {
+        origin = Clock::now();
+        tracing = trace;
+        active = true;
+    }
+    
+    static bool enabled() {
+        return active;
+    }
+    
+    static void count(Counter counter, std::uint64_t amount = 1) {
+        if (active) {
+            local().counters[counter] += amount;
         }
-
-        std::cout << "Files in " << folderPath << ":" << std::endl;
-        std::cout << "----------------------------------------" << std::endl;
-        
-        // Use a vector to collect entries before processing (faster iteration)
-        std::vector<fs::directory_entry> entries;
-        for (const auto& entry : fs::directory_iterator(folderPath)) {
-            if (entry.is_regular_file()) {
-                entries.push_back(entry);
+    }
+    
+    // Times a scope into a phase
+    class Timer {
+    public:
+        explicit Timer(Phase phase) : phase(phase), started(active ? Clock::now() : Clock::time_point()) {}
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer() {
+            if (active) {
+                record(phase, started, Clock::now());
             }
         }
         
-        // Cache extension mappings for this run
-        std::unordered_map<std::string, std::string> extensionCache;
-        
-        // Process files efficiently with minimal I/O operations
-        for (const auto& entry : entries) {
-            std::string filename = entry.path().filename().string();
-            std::string extension = entry.path().extension().string();
-            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-            
-            // Use cached category if available
-            std::string category;
-            auto cacheIt = extensionCache.find(extension);
-            if (cacheIt != extensionCache.end()) {
-                category = cacheIt->second;
-            } else {
-                category = getCategory(extension);
-                extensionCache[extension] = category;  // Cache for future use
+    private:
+        Phase phase;
+        Clock::time_point started;
+    };
+    
+    static void report(std::ostream& out) {
+        Merged merged = merge();
+        out << std::endl << "Run statistics (" << std::fixed << std::setprecision(1) << merged.wallMs << " ms):" << std::endl;
+        out << "  " << std::left << std::setw(16) << "Phase" << std::right << std::setw(10) << "Calls"
+            << std::setw(12) << "Total ms" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+            << std::setw(10) << "Max us" << std::endl;
+        for (int phase = 0; phase < phaseCount; ++phase) {
+            const PhaseStats& stats = merged.phases[phase];
+            if (stats.calls == 0) {
+                continue;
+            }
+            out << "  " << std::left << std::setw(16) << phaseNames[phase] << std::right << std::setw(10) << stats.calls
+                << std::setw(12) << stats.totalNs / 1e6 << std::setw(10) << percentileUs(stats, 0.50)
+                << std::setw(10) << percentileUs(stats, 0.99) << std::setw(10) << stats.maxNs / 1e3 << std::endl;
+        }
+        out << "  Counters:" << std::endl;
+        for (int counter = 0; counter < counterCount; ++counter) {
+            out << "    " << std::left << std::setw(18) << counterNames[counter] << std::right
+                << merged.counters[counter] << std::endl;
+        }
+        out << std::defaultfloat;
+    }
+    
+    static void reportJson(std::ostream& out) {
+        Merged merged = merge();
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(3) << "{\"wall_ms\":" << merged.wallMs << ",\"phases\":{";
+        bool first = true;
+        for (int phase = 0; phase < phaseCount; ++phase) {
+            const PhaseStats& stats = merged.phases[phase];
+            if (stats.calls == 0) {
+                continue;
+            }
+            json << (first ? "" : ",") << "\"" << phaseNames[phase] << "\":{\"calls\":" << stats.calls
+                 << ",\"total_ms\":" << stats.totalNs / 1e6 << ",\"p50_us\":" << percentileUs(stats, 0.50)
+                 << ",\"p99_us\":" << percentileUs(stats, 0.99) << ",\"max_us\":" << stats.maxNs / 1e3
+                 << ",\"histogram_us\":[";
+            for (int bucket = 0; bucket < buckets; ++bucket) {
+                json << (bucket ? "," : "") << stats.histogram[bucket];
+            }
+            json << "]}";
+            first = false;
+        }
+        json << "},\"counters\":{";
+        for (int counter = 0; counter < counterCount; ++counter) {
+            json << (counter ? "," : "") << "\"" << counterNames[counter] << "\":" << merged.counters[counter];
+        }
+        json << "}}";
+        out << json.str() << std::endl;
+    }
+    
+    // Chrome trace-event format (chrome://tracing, Perfetto): one complete
+    // event per timed scope, one track per thread
+    static bool writeTrace(const std::string& path) {
+        std::ofstream file(path, std::ios::trunc);
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        std::lock_guard<std::mutex> lock(mutex);
+        bool first = true;
+        for (const auto& thread : threads) {
+            for (const TraceEvent& event : thread->events) {
+                file << (first ? "" : ",\n") << "{\"name\":\"" << phaseNames[event.phase]
+                     << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id << ",\"ts\":" << event.startNs / 1000.0
+                     << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+                first = false;
             }
-            
-            auto fileSize = entry.file_size(); // More efficient than fs::file_size
-            
-            std::cout << "  " << filename << " -> " << category << " (" << formatFileSize(fileSize) << ")" << std::endl;
         }
+        file << "]}" << std::endl;
+        return static_cast<bool>(file);
     }
 
-    void organizeFolder(const std::string& folderPath) {
-        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
-            std::cout << "Error: Folder does not exist: " << folderPath << std::endl;
-            return;
+private:
+    // Bucket b holds durations below 2^b microseconds
+    static const int buckets = 24;
+    
+    struct PhaseStats {
+        std::uint64_t calls = 0;
+        std::uint64_t totalNs = 0;
+        std::uint64_t maxNs = 0;
+        std::uint64_t histogram[buckets] = {};
+    };
+    
+    struct TraceEvent {
+        Phase phase;
+        std::uint64_t startNs;
+        std::uint64_t durationNs;
+    };
+    
+    struct ThreadStats {
+        int id = 0;
+        PhaseStats phases[phaseCount];
+        std::uint64_t counters[counterCount] = {};
+        std::vector<TraceEvent> events;
+    };
+    
+    struct Merged {
+        double wallMs = 0;
+        PhaseStats phases[phaseCount];
+        std::uint64_t counters[counterCount] = {};
+    };
+    
+    static ThreadStats& local() {
+        thread_local ThreadStats* mine = nullptr;
+        if (!mine) {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(std::make_unique<ThreadStats>());
+            mine = threads.back().get();
+            mine->id = static_cast<int>(threads.size());
+        }
+        return *mine;
+    }
+    
+    static void record(Phase phase, Clock::time_point started, Clock::time_point finished) {
+        std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count();
+        ThreadStats& mine = local();
+        PhaseStats& stats = mine.phases[phase];
+        stats.calls++;
+        stats.totalNs += ns;
+        stats.maxNs = std::max(stats.maxNs, ns);
+        int bucket = 0;
+        for (std::uint64_t us = ns / 1000; us > 0 && bucket < buckets - 1; us >>= 1) {
+            ++bucket;
+        }
+        stats.histogram[bucket]++;
+        if (tracing) {
+            mine.events.push_back({phase, static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(started - origin).count()), ns});
+        }
+    }
+    
+    static Merged merge() {
+        Merged merged;
+        merged.wallMs = std::chrono::duration<double, std::milli>(Clock::now() - origin).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& thread : threads) {
+            for (int phase = 0; phase < phaseCount; ++phase) {
+                PhaseStats& into = merged.phases[phase];
+                const PhaseStats& from = thread->phases[phase];
+                into.calls += from.calls;
+                into.totalNs += from.totalNs;
+                into.maxNs = std::max(into.maxNs, from.maxNs);
+                for (int bucket = 0; bucket < buckets; ++bucket) {
+                    into.histogram[bucket] += from.histogram[bucket];
+                }
+            }
+            for (int counter = 0; counter < counterCount; ++counter) {
+                merged.counters[counter] += thread->counters[counter];
+            }
         }
+        return merged;
+    }
+    
+    // Upper bound of the histogram bucket holding the given fraction of calls
+    static double percentileUs(const PhaseStats& stats, double fraction) {
+        std::uint64_t rank = static_cast<std::uint64_t>(fraction * (stats.calls - 1));
+        std::uint64_t seen = 0;
+        for (int bucket = 0; bucket < buckets; ++bucket) {
+            seen += stats.histogram[bucket];
+            if (seen > rank) {
+                return std::min<double>(static_cast<double>(1ULL << bucket), stats.maxNs / 1e3);
+            }
+        }
+        return stats.maxNs / 1e3;
+    }
+    
+    static constexpr const char* phaseNames[phaseCount] = {
+        "read_directory", "name_index", "mkdir", "sniff", "metadata", "dedupe", "move_batch", "rename", "copy",
+        "journal", "restore"};
+    static constexpr const char* counterNames[counterCount] = {
+        "stat", "getdents", "rename", "rename_conflict", "name_probe", "cross_device", "ring_submit",
+        "journal_bytes", "fsync"};
+    
+    inline static bool active = false;
+    inline static bool tracing = false;
+    inline static Clock::time_point origin;
+    inline static std::mutex mutex;
+    inline static std::vector<std::unique_ptr<ThreadStats>> threads;
+};
 
-        std::cout << "Starting file organization in: " << folderPath << std::endl;
-        
-        // Create session ID for this organization session
-        std::string sessionId = getCurrentTimestamp();
-        std::cout << "Session ID: " << sessionId << std::endl;
-        
-        std::vector<FileMove> moves;
-        std::vector<fs::directory_entry> filesToProcess;
-        std::set<std::string> neededCategories;
-        
-        // First pass: collect all valid files and determine needed categories
-        std::cout << "Scanning files..." << std::flush;
-        for (const auto& entry : fs::directory_iterator(folderPath)) {
-            if (entry.is_regular_file() && isValidFile(entry.path(), folderPath)) {
-                filesToProcess.push_back(entry);
-                
-                // Determine which category this file belongs to
-                std::string extension = entry.path().extension().string();
-                std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-                std::string category = getCategory(extension);
-                neededCategories.insert(category);
+// Token bucket refilled at `rate` tokens per second, holding at most one
+// second's worth. A taker subtracts first and sleeps off any deficit outside
+// the lock, so concurrent takers queue up behind each other and the
+// combined rate holds however large a single request is.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+    
+    void setRate(double perSecond) {
+        std::lock_guard<std::mutex> lock(mutex);
+        rate = perSecond;
+        tokens = perSecond;
+        last = Clock::now();
+    }
+    
+    double perSecond() const {
+        return rate;
+    }
+    
+    void take(double count) {
+        double deficit = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Clock::time_point now = Clock::now();
+            tokens = std::min(rate, tokens + std::chrono::duration<double>(now - last).count() * rate);
+            last = now;
+            tokens -= count;
+            deficit = -tokens;
+        }
+        if (deficit > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(deficit / rate));
+        }
+    }
+
+private:
+    double rate = 0;
+    double tokens = 0;
+    Clock::time_point last;
+    std::mutex mutex;
+};
+
+// Process-wide limits for --max-ops and --max-bandwidth, shared by all
+// workers and by every folder of a --batch run. Renames and restores are
+// charged a batch at a time and copies a piece at a time, never per file
+// or per write. Like RunStats, each hook costs a single branch while no
+// limit is set.
+class IoThrottle {
+public:
+    static void limit(double opsPerSecond, double bytesPerSecond) {
+        opsLimited = opsPerSecond > 0;
+        bytesLimited = bytesPerSecond > 0;
+        if (opsLimited) {
+            ops.setRate(opsPerSecond);
+        }
+        if (bytesLimited) {
+            data.setRate(bytesPerSecond);
+        }
+    }
+    
+    static void operations(size_t count) {
+        if (opsLimited) {
+            ops.take(static_cast<double>(count));
+        }
+    }
+    
+    static void bytes(std::uint64_t count) {
+        if (bytesLimited) {
+            data.take(static_cast<double>(count));
+        }
+    }
+    
+    // Shrinks a batch to about 100 ms of operations under --max-ops, so
+    // work is paced in small steps and progress keeps coming
+    static size_t batchSize(size_t preferred) {
+        if (!opsLimited) {
+            return preferred;
+        }
+        return std::clamp<size_t>(static_cast<size_t>(ops.perSecond() / 10), 1, preferred);
+    }
+    
+    // How much of a copy to issue before charging for it again
+    static std::uint64_t copyPiece(std::uint64_t remaining) {
+        if (!bytesLimited) {
+            return remaining;
+        }
+        std::uint64_t piece = std::max<std::uint64_t>(static_cast<std::uint64_t>(data.perSecond() / 10), 64 * 1024);
+        return std::min(remaining, piece);
+    }
+
+private:
+    inline static bool opsLimited = false;
+    inline static bool bytesLimited = false;
+    inline static TokenBucket ops;
+    inline static TokenBucket data;
+};
+
+// How RunStats are reported once a command finishes
+enum class StatsMode {
+    off,
+    text,   // --stats
+    json    // --stats-json
+};
+
+// Work-stealing thread pool behind --batch. Every worker owns a deque of
+// tasks: it pushes and pops its own work at the back, and an idle worker
+// steals from the front of another's. A task that needs parallelism itself
+// calls parallelFor() (runParallel() does this automatically on a pool
+// thread), which queues helpers on its own deque and keeps running tasks
+// while it waits, so one large folder's batches spread over cores that small
+// folders have left idle and nested waits never block a worker.
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+    
+    explicit WorkStealingPool(size_t workerCount) {
+        workerCount = std::max<size_t>(workerCount, 1);
+        for (size_t w = 0; w < workerCount; ++w) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t w = 0; w < workerCount; ++w) {
+            threads.emplace_back(&WorkStealingPool::workerLoop, this, w);
+        }
+    }
+    
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    
+    size_t size() const {
+        return queues.size();
+    }
+    
+    // From a pool thread the task goes to that worker's own deque; from
+    // outside, the deques are filled round robin
+    void submit(Task task) {
+        size_t target = currentPool == this ? currentWorker : nextQueue++ % queues.size();
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+    
+    // Blocks a thread outside the pool until every submitted task, including
+    // the ones those tasks submitted, has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&]() { return pending == 0; });
+    }
+    
+    // Runs body(i) for every i in [0, count) on up to `width` workers. Must be
+    // called from a pool thread.
+    template <typename Body>
+    void parallelFor(size_t count, size_t width, Body& body) {
+        std::atomic<size_t> next{0};
+        auto drain = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                body(i);
             }
+        };
+        size_t helpers = std::min(width, count) - 1;
+        std::atomic<size_t> unfinished{helpers};
+        for (size_t h = 0; h < helpers; ++h) {
+            submit([&]() {
+                drain();
+                unfinished--;
+            });
         }
-        
-        int totalFiles = filesToProcess.size();
-        if (totalFiles == 0) {
-            std::cout << "\nNo files to organize." << std::endl;
-            return;
+        drain();
+        // Helpers reference this frame, so all of them must be done, but the
+        // wait is spent running other work
+        while (unfinished > 0) {
+            if (!runOne(currentWorker)) {
+                std::this_thread::yield();
+            }
         }
-        
-        std::cout << " Found " << totalFiles << " files to organize." << std::endl;
-        
-        // Create only the category folders that are actually needed
-        createCategoryFolders(folderPath, neededCategories);
-        
-        std::cout << "Processing files:" << std::endl;
-        
-        int processedFiles = 0;
-        int lastProgress = -1;
-        
-        // Process files efficiently
-        for (const auto& entry : filesToProcess) {
-            std::string filename = entry.path().filename().string();
-            std::string extension = entry.path().extension().string();
-            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-            
-            std::string category = getCategory(extension);
-            std::string targetDir = folderPath + "/" + category;
-            std::string targetPath = targetDir + "/" + filename;
-            
-            // Handle file name conflicts
-            targetPath = getUniqueFilePath(targetPath);
-            
-            try {
-                // Record the move for undo functionality
-                FileMove move;
-                move.originalPath = entry.path().string();
-                move.newPath = targetPath;
-                move.timestamp = sessionId;
-                moves.push_back(move);
-                
-                fs::rename(entry.path(), targetPath);
-                processedFiles++;
-                
-                // Show progress only at 10% intervals or every 100 files
-                int percentage = (processedFiles * 100) / totalFiles;
-                if (percentage != lastProgress && (percentage % 10 == 0 || processedFiles % 100 == 0 || processedFiles == totalFiles)) {
-                    std::cout << "Progress: " << processedFiles << "/" << totalFiles << " (" << percentage << "%)" << std::endl;
-                    lastProgress = percentage;
+    }
+    
+    // The pool the calling thread works for, if any
+    static WorkStealingPool* current() {
+        return currentPool;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> queued{0};    // Tasks sitting in deques; raised under `mutex`
+    std::atomic<size_t> pending{0};   // Tasks submitted and not yet finished
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool stopping = false;
+    
+    inline static thread_local WorkStealingPool* currentPool = nullptr;
+    inline static thread_local size_t currentWorker = 0;
+    
+    // Takes the newest task of worker `self`, or else the oldest of another
+    bool runOne(size_t self) {
+        Task task;
+        for (size_t k = 0; k < queues.size() && !task; ++k) {
+            Queue& queue = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                if (k == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
                 }
-                
-            } catch (const fs::filesystem_error& e) {
-                std::cout << "Error moving " << filename << ": " << e.what() << std::endl;
             }
         }
-        
-        // Save move log for undo functionality (single write operation)
-        saveUndoLog(folderPath, moves, sessionId);
-        
-        std::cout << "File organization completed! Processed " << processedFiles << " files." << std::endl;
-        std::cout << "To undo: --undo \"" << folderPath << "\" " << sessionId << std::endl;
+        if (!task) {
+            return false;
+        }
+        queued--;
+        task();
+        if (--pending == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.notify_all();
+        }
+        return true;
     }
     
-    void showUndoHistory(const std::string& folderPath) {
-        std::string logFile = folderPath + "/.fileorganizer_log.txt";
-        
-        if (!fs::exists(logFile)) {
-            std::cout << "No organization history found for this folder." << std::endl;
-            return;
+    void workerLoop(size_t self) {
+        currentPool = this;
+        currentWorker = self;
+        for (;;) {
+            if (runOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return queued > 0 || stopping; });
+            if (stopping && queued == 0) {
+                return;
+            }
         }
+    }
+};
+
+// Runs task(i) for every i in [0, count) on up to `jobs` threads.
+// Indices are handed out dynamically so uneven tasks still balance. On a
+// WorkStealingPool thread the pool's workers are used instead of new threads.
+template <typename Task>
+void runParallel(size_t count, int jobs, Task task) {
+    if (WorkStealingPool* pool = WorkStealingPool::current(); pool && count > 1 && jobs > 1) {
+        pool->parallelFor(count, static_cast<size_t>(jobs), task);
+        return;
+    }
+    size_t workers = std::min(static_cast<size_t>(std::max(jobs, 1)), count);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    threads.reserve(workers);
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                task(i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Fixed-capacity blocking queue used to stream work from a producer to its
+// consumers. push() blocks while the queue is full, keeping memory bounded.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+    
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+    
+    // Non-blocking push for callers that shed load instead of waiting
+    bool tryPush(T item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() >= capacity || closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    // Returns false once the queue is closed and fully drained
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    // Like pop(), but after the first item also takes whatever else is
+    // already queued, up to maxItems, so consumers can work in batches
+    bool popBatch(std::vector<T>& batch, size_t maxItems) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        while (!items.empty() && batch.size() < maxItems) {
+            batch.push_back(std::move(items.front()));
+            items.pop_front();
+        }
+        notFull.notify_all();
+        return true;
+    }
+    
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+// Size and modification time of a file, for rules that match on them
+struct FileStatus {
+    std::uintmax_t size = 0;
+    std::int64_t modified = 0;   // Seconds since the Unix epoch
+};
+
+// One entry reported by scanDirectory(). The file type comes straight from
+// the directory listing; size is only looked up when fileSize() is called.
+struct ScannedEntry {
+    fs::path path;
+    std::string name;
+    bool isRegularFile = false;   // Follows symlinks, like directory_entry::is_regular_file()
+    bool isDirectory = false;
+    int directoryFd = -1;         // Parent directory, open only during the visit (Linux)
+    std::uint64_t inode = 0;      // From the directory listing (Linux)
+    
+    std::uintmax_t fileSize(std::error_code& ec) const {
+#if defined(__linux__) && defined(STATX_SIZE)
+        struct statx info;
+        RunStats::count(RunStats::counterStat);
+        if (statx(directoryFd, name.c_str(), 0, STATX_SIZE, &info) != 0) {
+            ec = std::error_code(errno, std::generic_category());
+            return 0;
+        }
+        return info.stx_size;
+#else
+        return fs::file_size(path, ec);
+#endif
+    }
+    
+    FileStatus status(std::error_code& ec) const {
+        FileStatus result;
+#if defined(__linux__) && defined(STATX_SIZE)
+        struct statx info;
+        RunStats::count(RunStats::counterStat);
+        if (statx(directoryFd, name.c_str(), 0, STATX_SIZE | STATX_MTIME, &info) != 0) {
+            ec = std::error_code(errno, std::generic_category());
+            return result;
+        }
+        result.size = info.stx_size;
+        result.modified = info.stx_mtime.tv_sec;
+#else
+        result.size = fs::file_size(path, ec);
+        auto written = fs::last_write_time(path, ec);
+        auto systemTime = std::chrono::system_clock::now() +
+                          std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                              written - fs::file_time_type::clock::now());
+        result.modified = std::chrono::duration_cast<std::chrono::seconds>(systemTime.time_since_epoch()).count();
+#endif
+        return result;
+    }
+};
+
+#ifdef __linux__
+// Record layout returned by the getdents64 system call
+struct LinuxDirent64 {
+    std::uint64_t d_ino;
+    std::int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+// Calls visit(entry) for every entry of `directory` in listing order. On
+// Linux entries are read in 64 KB getdents64 batches and d_type is used to
+// avoid a stat per entry; elsewhere this falls back to directory_iterator.
+template <typename Visit>
+void scanDirectory(const fs::path& directory, Visit visit, std::error_code& ec) {
+#ifdef __linux__
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        ec = std::error_code(errno, std::generic_category());
+        return;
+    }
+    
+    std::vector<char> buffer(64 * 1024);
+    for (;;) {
+        long bytesRead;
+        {
+            RunStats::Timer timer(RunStats::phaseReadDirectory);
+            RunStats::count(RunStats::counterGetdents);
+            bytesRead = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        }
+        if (bytesRead < 0) {
+            ec = std::error_code(errno, std::generic_category());
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        
+        for (long offset = 0; offset < bytesRead;) {
+            auto* record = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+            offset += record->d_reclen;
+            
+            const char* name = record->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+            
+            ScannedEntry entry;
+            entry.name = name;
+            entry.path = directory / entry.name;
+            entry.directoryFd = fd;
+            entry.inode = record->d_ino;
+            if (record->d_type == DT_LNK || record->d_type == DT_UNKNOWN) {
+                // Only symlinks and filesystems without d_type need a stat
+                struct stat info;
+                RunStats::count(RunStats::counterStat);
+                if (fstatat(fd, name, &info, 0) == 0) {
+                    entry.isRegularFile = S_ISREG(info.st_mode);
+                    entry.isDirectory = S_ISDIR(info.st_mode);
+                }
+            } else {
+                entry.isRegularFile = record->d_type == DT_REG;
+                entry.isDirectory = record->d_type == DT_DIR;
+            }
+            visit(entry);
+        }
+    }
+    close(fd);
+#else
+    fs::directory_iterator it(directory, ec);
+    for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        ScannedEntry entry;
+        entry.path = it->path();
+        entry.name = entry.path.filename().string();
+        std::error_code typeError;
+        entry.isRegularFile = it->is_regular_file(typeError);
+        entry.isDirectory = it->is_directory(typeError);
+        visit(entry);
+    }
+#endif
+}
+
+// Depth-first walk built on scanDirectory(). descend(entry, depth) decides
+// whether a sub-directory is entered and visit(entry, depth) sees all other
+// entries. Unreadable sub-directories are skipped; only a failure to read
+// the root itself is reported through ec.
+template <typename Descend, typename Visit>
+void walkDirectoryTree(const fs::path& root, Descend descend, Visit visit, std::error_code& ec) {
+    std::vector<std::pair<fs::path, int>> pending;
+    pending.emplace_back(root, 0);
+    bool isRoot = true;
+    
+    while (!pending.empty()) {
+        auto [directory, depth] = std::move(pending.back());
+        pending.pop_back();
+        
+        std::vector<std::pair<fs::path, int>> children;
+        std::error_code scanError;
+        scanDirectory(directory, [&](const ScannedEntry& entry) {
+            if (entry.isDirectory) {
+                if (descend(entry, depth)) {
+                    children.emplace_back(entry.path, depth + 1);
+                }
+            } else {
+                visit(entry, depth);
+            }
+        }, scanError);
+        if (scanError && isRoot) {
+            ec = scanError;
+        }
+        isRoot = false;
+        
+        // Push in reverse so sub-directories are visited in listing order
+        std::move(children.rbegin(), children.rend(), std::back_inserter(pending));
+    }
+}
+
+// Renames `from` to `to` without ever replacing an existing file. Fails with
+// errc::file_exists when the target name is taken. On Linux this is a single
+// atomic renameat2(RENAME_NOREPLACE); filesystems that do not support the
+// flag (and other platforms) fall back to an exists() check first.
+bool renameNoReplace(const fs::path& from, const fs::path& to, std::error_code& ec) {
+    ec.clear();
+#if defined(__linux__) && defined(SYS_renameat2)
+    if (syscall(SYS_renameat2, AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) {
+        return true;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+#endif
+    if (fs::exists(to, ec)) {
+        ec = std::make_error_code(std::errc::file_exists);
+        return false;
+    }
+    fs::rename(from, to, ec);
+    return !ec;
+}
+
+// Names present in one target directory, read with a single scan the first
+// time the directory is used in a run. Free "stem_N.ext" names are then
+// picked in memory instead of probing the filesystem for every candidate.
+// Not thread-safe: each target directory is owned by a single worker.
+class DirectoryNameSet {
+public:
+    explicit DirectoryNameSet(std::string_view directory) {
+        RunStats::Timer timer(RunStats::phaseNameIndex);
+        std::error_code ec;
+        scanDirectory(fs::path(directory), [&](const ScannedEntry& entry) {
+            names.insert(text.store(entry.name));
+        }, ec);
+    }
+    
+    // Returns `filename` or the first free "stem_N.ext" variant, and marks
+    // the returned name as taken. The view stays valid as long as the set.
+    std::string_view claim(std::string_view filename) {
+        auto taken = names.find(filename);
+        if (taken == names.end()) {
+            return *names.insert(text.store(filename)).first;
+        }
+        
+        fs::path path(filename);
+        std::string stem = path.stem().string();
+        std::string extension = path.extension().string();
+        
+        // Resume numbering where the last collision for this name stopped
+        unsigned& counter = nextSuffix.try_emplace(*taken, 1).first->second;
+        for (;;) {
+            std::string candidate = stem + "_" + std::to_string(counter++) + extension;
+            RunStats::count(RunStats::counterNameProbe);
+            if (names.find(candidate) == names.end()) {
+                return *names.insert(text.store(candidate)).first;
+            }
+        }
+    }
+
+private:
+    PathArena text;
+    std::unordered_set<std::string_view> names;
+    std::unordered_map<std::string_view, unsigned> nextSuffix;
+};
+
+#ifdef FILEORGANIZER_HAVE_IO_URING
+// Minimal io_uring submission/completion ring driven through raw system
+// calls, used to batch renameat2 and mkdirat. A ring is not thread-safe, so
+// every worker owns its own. init() fails cleanly on kernels without the
+// required opcodes, letting callers fall back to blocking std::filesystem.
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    
+    ~IoUring() {
+        teardown();
+    }
+    
+    bool init(unsigned entries) {
+        io_uring_params params{};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) {
+            return false;
+        }
+        
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+        }
+        
+        sqRing = mapRegion(sqRingBytes, IORING_OFF_SQ_RING);
+        if (!sqRing) {
+            return false;
+        }
+        cqRing = singleMap ? sqRing : mapRegion(cqRingBytes, IORING_OFF_CQ_RING);
+        if (!cqRing) {
+            return false;
+        }
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mapRegion(sqeBytes, IORING_OFF_SQES));
+        if (!sqes) {
+            return false;
+        }
+        
+        char* sq = static_cast<char*>(sqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        capacity = params.sq_entries;
+        
+        return supportsOpcode(IORING_OP_RENAMEAT) && supportsOpcode(IORING_OP_MKDIRAT);
+    }
+    
+    unsigned size() const { return capacity; }
+    
+    void queueRename(const char* from, const char* to, unsigned flags, std::uint64_t userData) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<std::uint64_t>(from);
+        sqe->len = static_cast<unsigned>(AT_FDCWD);
+        sqe->off = reinterpret_cast<std::uint64_t>(to);
+        sqe->rename_flags = flags;
+        sqe->user_data = userData;
+    }
+    
+    void queueMkdir(const char* path, mode_t mode, std::uint64_t userData) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_MKDIRAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<std::uint64_t>(path);
+        sqe->len = mode;
+        sqe->user_data = userData;
+    }
+    
+    // Submits everything queued and calls onComplete(userData, result) for
+    // each completion; results are 0 or a negated errno value. If the ring
+    // fails, completions for everything already submitted are still reaped
+    // before the ring is torn down, so no request outlives the caller's
+    // paths; entries never submitted get no callback. Returns false in that
+    // case, and ready() is false from then on.
+    template <typename OnComplete>
+    bool submitAndWait(OnComplete onComplete) {
+        RunStats::count(RunStats::counterRingSubmit);
+        unsigned outstanding = pending;
+        unsigned toSubmit = pending;
+        pending = 0;
+        bool failed = false;
+        while (outstanding > 0) {
+            long rc = syscall(__NR_io_uring_enter, ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rc < 0 && (failed || toSubmit == 0)) {
+                // Not even waiting works: take what has completed and give up
+                failed = true;
+                reap(outstanding, onComplete);
+                break;
+            }
+            if (rc < 0) {
+                // Nothing of what is left was submitted; it goes with the ring
+                failed = true;
+                outstanding -= toSubmit;
+                toSubmit = 0;
+            } else {
+                toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(rc));
+            }
+            reap(outstanding, onComplete);
+        }
+        if (failed) {
+            teardown();
+        }
+        return !failed;
+    }
+    
+    bool ready() const { return ringFd >= 0; }
+
+private:
+    void* mapRegion(size_t bytes, off_t offset) {
+        void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return region == MAP_FAILED ? nullptr : region;
+    }
+    
+    bool supportsOpcode(unsigned opcode) {
+        const unsigned probeOps = 256;
+        std::vector<char> buffer(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, probeOps) < 0) {
+            return false;
+        }
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+    
+    template <typename OnComplete>
+    void reap(unsigned& outstanding, OnComplete& onComplete) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail && outstanding > 0; ++head, --outstanding) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            onComplete(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    
+    // Unmaps the rings and closes the descriptor; queued entries that were
+    // never submitted are discarded with it
+    void teardown() {
+        if (sqes) {
+            munmap(sqes, sqeBytes);
+        }
+        if (cqRing && cqRing != sqRing) {
+            munmap(cqRing, cqRingBytes);
+        }
+        if (sqRing) {
+            munmap(sqRing, sqRingBytes);
+        }
+        if (ringFd >= 0) {
+            close(ringFd);
+        }
+        sqes = nullptr;
+        cqRing = sqRing = nullptr;
+        ringFd = -1;
+        pending = 0;
+    }
+    
+    io_uring_sqe* nextSqe() {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++pending;
+        return sqe;
+    }
+    
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqRingBytes = 0;
+    size_t cqRingBytes = 0;
+    size_t sqeBytes = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned capacity = 0;
+    unsigned pending = 0;
+};
+#else
+// Stand-in for platforms without io_uring: init() always reports that the
+// backend is unavailable, so callers stay on the blocking path
+class IoUring {
+public:
+    bool init(unsigned) { return false; }
+    unsigned size() const { return 0; }
+    void queueRename(const char*, const char*, unsigned, std::uint64_t) {}
+    void queueMkdir(const char*, unsigned, std::uint64_t) {}
+    template <typename OnComplete>
+    bool submitAndWait(OnComplete) { return false; }
+    bool ready() const { return false; }
+};
+#endif
+
+// Little-endian encoding helpers for the binary undo journal
+void putU32(std::string& out, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void putU64(std::string& out, std::uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void putString(std::string& out, std::string_view value) {
+    putU32(out, static_cast<std::uint32_t>(value.size()));
+    out += value;
+}
+
+// Writes folder + "/" + name as one length-prefixed string, like putString(joinPath())
+void putPath(std::string& out, std::string_view folder, std::string_view name) {
+    bool separate = !folder.empty() && pathSeparators.find(folder.back()) == std::string_view::npos;
+    putU32(out, static_cast<std::uint32_t>(folder.size() + (separate ? 1 : 0) + name.size()));
+    out += folder;
+    if (separate) {
+        out += '/';
+    }
+    out += name;
+}
+
+std::uint32_t getU32(const char* data) {
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<std::uint32_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+std::uint64_t getU64(const char* data) {
+    std::uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Sequential reader over a record payload; every read is bounds-checked and
+// a short payload simply turns the reader into the failed state
+class ByteReader {
+public:
+    ByteReader(const char* data, size_t size) : data(data), size(size) {}
+    
+    bool ok() const { return good; }
+    bool atEnd() const { return offset >= size; }
+    
+    std::uint32_t u32() {
+        if (!require(4)) {
+            return 0;
+        }
+        std::uint32_t value = getU32(data + offset);
+        offset += 4;
+        return value;
+    }
+    
+    std::uint64_t u64() {
+        if (!require(8)) {
+            return 0;
+        }
+        std::uint64_t value = getU64(data + offset);
+        offset += 8;
+        return value;
+    }
+    
+    std::string string() {
+        return std::string(view());
+    }
+    
+    // Like string(), but refers to the reader's buffer instead of copying
+    std::string_view view() {
+        std::uint32_t length = u32();
+        if (!require(length)) {
+            return std::string_view();
+        }
+        std::string_view value(data + offset, length);
+        offset += length;
+        return value;
+    }
+
+private:
+    bool require(size_t bytes) {
+        if (!good || size - offset < bytes) {
+            good = false;
+            return false;
+        }
+        return true;
+    }
+    
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+    bool good = true;
+};
+
+// Creates a new file named `base` plus a ".<pid>.<n>" suffix, trying the
+// next suffix when a name is taken. Nothing that already exists is opened,
+// a symlink included, so concurrent writers and planted files cannot make
+// two writers share a file or redirect the data. Returns the descriptor
+// and sets `created`, or returns -1 with errno set.
+int createUniqueFile(const std::string& base, int mode, std::string& created) {
+    static std::atomic<std::uint64_t> counter{0};
+#ifdef _WIN32
+    (void)mode;
+    int process = _getpid();
+#else
+    int process = static_cast<int>(getpid());
+#endif
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        created = base + "." + std::to_string(process) + "." + std::to_string(counter++);
+#ifdef _WIN32
+        int fd = _open(created.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        int fd = open(created.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+#endif
+        if (fd >= 0 || errno != EEXIST) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// Writes all of `size` bytes at the descriptor's position
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, 1 << 30)));
+#else
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool closeFile(int fd) {
+#ifdef _WIN32
+    return _close(fd) == 0;
+#else
+    return close(fd) == 0;
+#endif
+}
+
+// Replaces `path` with `bytes` through a temporary file of this writer's
+// own, so readers see either the old or the new contents in full and
+// concurrent writers never mix their data
+bool replaceFile(const std::string& path, const std::string& bytes) {
+    std::string temporary;
+    int fd = createUniqueFile(path + ".tmp", 0666, temporary);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = writeAll(fd, bytes.data(), bytes.size());
+    written = closeFile(fd) && written;
+    std::error_code ec;
+    if (written) {
+        fs::rename(temporary, path, ec);
+    }
+    if (!written || ec) {
+        std::error_code ignored;
+        fs::remove(temporary, ignored);
+        return false;
+    }
+    return true;
+}
+
+// Flushes stdio buffers and asks the OS to persist the file's data
+bool syncFile(FILE* file) {
+    if (std::fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    RunStats::count(RunStats::counterFsync);
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+std::uint32_t crc32(const char* data, size_t size) {
+    static const auto table = []() {
+        std::vector<std::uint32_t> entries(256);
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+    
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Built-in file categories. Lookups hand out this small ID; the folder
+// name is only produced when a path has to be built. Rule targets (see
+// RuleSet) are numbered after the built-in values.
+enum class Category : std::uint16_t { Images, Music, Videos, Documents, Others };
+
+constexpr const char* categoryName(Category category) {
+    constexpr const char* names[] = {"Images", "Music", "Videos", "Documents", "Others"};
+    return names[static_cast<size_t>(category)];
+}
+
+// The extension of a filename with the same rules as fs::path::extension()
+// (a leading dot starts a hidden name, not an extension), without the dot
+constexpr std::string_view extensionOf(std::string_view filename) {
+    size_t dot = filename.rfind('.');
+    if (dot == std::string_view::npos || dot == 0 || filename == "..") {
+        return std::string_view();
+    }
+    return filename.substr(dot + 1);
+}
+
+// Maps extensions to categories through a perfect hash built at compile
+// time. An extension of up to eight characters is lowercased and packed
+// into a 64-bit key; the multiplier of the multiplicative hash is searched
+// for at compile time so every built-in key owns its slot. A lookup is one
+// multiply and one compare, allocates nothing and shares no mutable state.
+class ExtensionTable {
+public:
+    static constexpr Category lookup(std::string_view extension) {
+        std::uint64_t key = pack(extension);
+        const Slot& slot = table.slots[slotOf(key, multiplier)];
+        return (key != 0 && slot.key == key) ? slot.category : Category::Others;
+    }
+
+private:
+    struct Entry {
+        const char* extension;
+        Category category;
+    };
+    
+    struct Slot {
+        std::uint64_t key = 0;
+        Category category = Category::Others;
+    };
+    
+    static constexpr Entry entries[] = {
+        // Images
+        {"jpg", Category::Images}, {"jpeg", Category::Images}, {"png", Category::Images},
+        {"gif", Category::Images}, {"bmp", Category::Images}, {"tiff", Category::Images},
+        {"svg", Category::Images}, {"webp", Category::Images}, {"ico", Category::Images},
+        
+        // Audio
+        {"mp3", Category::Music}, {"wav", Category::Music}, {"flac", Category::Music},
+        {"aac", Category::Music}, {"ogg", Category::Music}, {"wma", Category::Music},
+        {"m4a", Category::Music}, {"opus", Category::Music},
+        
+        // Video
+        {"mp4", Category::Videos}, {"avi", Category::Videos}, {"mkv", Category::Videos},
+        {"mov", Category::Videos}, {"wmv", Category::Videos}, {"flv", Category::Videos},
+        {"webm", Category::Videos}, {"m4v", Category::Videos}, {"3gp", Category::Videos},
+        
+        // Documents
+        {"pdf", Category::Documents}, {"doc", Category::Documents}, {"docx", Category::Documents},
+        {"txt", Category::Documents}, {"rtf", Category::Documents}, {"odt", Category::Documents},
+        {"xls", Category::Documents}, {"xlsx", Category::Documents}, {"ppt", Category::Documents},
+        {"pptx", Category::Documents}, {"csv", Category::Documents}, {"md", Category::Documents}
+    };
+    
+    static constexpr size_t tableBits = 7;
+    static constexpr size_t tableSize = size_t(1) << tableBits;
+    
+    struct Table {
+        Slot slots[tableSize];
+    };
+    
+    // Lowercase little-endian packing; 0 for empty or over-long extensions
+    static constexpr std::uint64_t pack(std::string_view extension) {
+        if (extension.empty() || extension.size() > 8) {
+            return 0;
+        }
+        std::uint64_t key = 0;
+        for (size_t i = 0; i < extension.size(); ++i) {
+            char c = extension[i];
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+            key |= std::uint64_t(static_cast<unsigned char>(c)) << (8 * i);
+        }
+        return key;
+    }
+    
+    static constexpr size_t slotOf(std::uint64_t key, std::uint64_t factor) {
+        return static_cast<size_t>((key * factor) >> (64 - tableBits));
+    }
+    
+    // First odd splitmix64 output that spreads the built-in keys without collisions
+    static constexpr std::uint64_t findMultiplier() {
+        std::uint64_t state = 0;
+        while (true) {
+            state += 0x9E3779B97F4A7C15ull;
+            std::uint64_t candidate = state;
+            candidate = (candidate ^ (candidate >> 30)) * 0xBF58476D1CE4E5B9ull;
+            candidate = (candidate ^ (candidate >> 27)) * 0x94D049BB133111EBull;
+            candidate = (candidate ^ (candidate >> 31)) | 1;
+            
+            bool used[tableSize] = {};
+            bool perfect = true;
+            for (const Entry& entry : entries) {
+                size_t slot = slotOf(pack(entry.extension), candidate);
+                if (used[slot]) {
+                    perfect = false;
+                    break;
+                }
+                used[slot] = true;
+            }
+            if (perfect) {
+                return candidate;
+            }
+        }
+    }
+    
+    static constexpr Table buildTable() {
+        Table built{};
+        for (const Entry& entry : entries) {
+            std::uint64_t key = pack(entry.extension);
+            Slot& slot = built.slots[slotOf(key, multiplier)];
+            slot.key = key;
+            slot.category = entry.category;
+        }
+        return built;
+    }
+    
+    // Defined below, once the class is complete and its helpers are usable
+    static const std::uint64_t multiplier;
+    static const Table table;
+};
+
+constexpr std::uint64_t ExtensionTable::multiplier = ExtensionTable::findMultiplier();
+constexpr ExtensionTable::Table ExtensionTable::table = ExtensionTable::buildTable();
+
+// User-defined categorisation rules (--rules FILE). A rules file is a list
+// of blocks, one per target folder:
+//
+//   [Screenshots]
+//   glob = Screenshot*.png
+//   size = 10K..5M
+//   mtime = 2024-01-01..
+//
+// ext, glob and regex lines may repeat and match when any of their patterns
+// does; different kinds of condition must all match. Rules are tried in
+// file order, and files no rule matches fall back to the built-in table.
+//
+// Every name pattern of every rule is compiled at load time into a single
+// automaton over byte classes, run as a lazily built, cached DFA, and
+// size/mtime conditions into sorted range tables that hold a bit mask of
+// rules per interval. Classifying a file is one pass over its name plus two
+// binary searches, however many rules there are.
+class RuleSet {
+public:
+    RuleSet() {
+        for (int id = 0; id <= static_cast<int>(Category::Others); ++id) {
+            folders.push_back(categoryName(static_cast<Category>(id)));
+        }
+    }
+    
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream file(path);
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        
+        std::vector<std::vector<std::string>> patternSources;   // Per rule: ext, glob, regex
+        std::string line;
+        int lineNumber = 0;
+        auto fail = [&](const std::string& message) {
+            error = path + ":" + std::to_string(lineNumber) + ": " + message;
+            return false;
+        };
+        
+        while (std::getline(file, line)) {
+            ++lineNumber;
+            std::string text = trim(line);
+            if (text.empty() || text[0] == '#') {
+                continue;
+            }
+            for (char c : text + '\n') {
+                contentHash = (contentHash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+            }
+            
+            if (text.front() == '[') {
+                if (text.back() != ']') {
+                    return fail("missing ']'");
+                }
+                std::string folder = trim(text.substr(1, text.size() - 2));
+                if (folder.empty() || folder[0] == '.' || folder.find_first_of("/\\") != std::string::npos) {
+                    return fail("invalid folder name '" + folder + "'");
+                }
+                Rule rule;
+                rule.target = folderId(folder);
+                rules.push_back(rule);
+                continue;
+            }
+            
+            size_t equals = text.find('=');
+            if (equals == std::string::npos) {
+                return fail("expected 'key = value'");
+            }
+            if (rules.empty()) {
+                return fail("condition before the first [folder]");
+            }
+            std::string key = trim(text.substr(0, equals));
+            std::string value = trim(text.substr(equals + 1));
+            Rule& rule = rules.back();
+            
+            std::string patternError;
+            if (key == "ext") {
+                std::replace(value.begin(), value.end(), ',', ' ');
+                std::istringstream extensions(value);
+                std::string extension;
+                while (extensions >> extension) {
+                    if (extension[0] == '.') {
+                        extension.erase(0, 1);
+                    }
+                    addPattern(rule, Name::ext, compileGlob("*." + escapeGlob(extension), patternError));
+                }
+            } else if (key == "glob") {
+                addPattern(rule, Name::glob, compileGlob(value, patternError));
+            } else if (key == "regex") {
+                addPattern(rule, Name::regex, compileRegex(value, patternError));
+            } else if (key == "size") {
+                if (!parseRange(value, parseSize, rule.size)) {
+                    return fail("invalid size range '" + value + "'");
+                }
+            } else if (key == "mtime") {
+                if (!parseRange(value, parseDate, rule.mtime)) {
+                    return fail("invalid date range '" + value + "' (use YYYY-MM-DD..YYYY-MM-DD)");
+                }
+                rule.mtime.high = rule.mtime.high == std::numeric_limits<std::int64_t>::max()
+                                  ? rule.mtime.high : rule.mtime.high + 86399;   // Whole last day
+            } else {
+                return fail("unknown condition '" + key + "'");
+            }
+            if (!patternError.empty()) {
+                return fail(patternError);
+            }
+        }
+        
+        for (size_t r = 0; r < rules.size(); ++r) {
+            const Rule& rule = rules[r];
+            bool hasName = std::any_of(std::begin(rule.nameGroups), std::end(rule.nameGroups),
+                                       [](int group) { return group >= 0; });
+            if (!hasName && !rule.size.present && !rule.mtime.present) {
+                error = path + ": [" + folderName(rule.target) + "] has no conditions";
+                return false;
+            }
+        }
+        
+        words = (rules.size() + 63) / 64;
+        buildMatcher();
+        sizeTable = buildRangeTable(&Rule::size);
+        mtimeTable = buildRangeTable(&Rule::mtime);
+        return true;
+    }
+    
+    bool empty() const { return rules.empty(); }
+    size_t ruleCount() const { return rules.size(); }
+    
+    // Whether classify() depends on a file's size or mtime, not just its name
+    bool needsStatus() const { return sizeTable.used || mtimeTable.used; }
+    
+    // Changes whenever the rules would classify differently (FNV-1a of the
+    // significant lines)
+    std::uint64_t fingerprint() const { return contentHash; }
+    
+    // Sets category to the target of the first matching rule. status(ec) is
+    // only called when some rule has a size or mtime condition.
+    template <typename Status>
+    bool classify(std::string_view filename, Status status, Category& category) const {
+        if (rules.empty()) {
+            return false;
+        }
+        
+        const std::uint64_t* sizeMask = nullptr;
+        const std::uint64_t* mtimeMask = nullptr;
+        if (sizeTable.used || mtimeTable.used) {
+            std::error_code ec;
+            FileStatus info = status(ec);
+            sizeMask = ec ? sizeTable.unconstrained.data() : sizeTable.lookup(info.size, words);
+            mtimeMask = ec ? mtimeTable.unconstrained.data() : mtimeTable.lookup(info.modified, words);
+        }
+        
+        std::vector<std::uint64_t> uncachedMask;
+        const std::uint64_t* nameMask = matchName(filename, uncachedMask);
+        
+        for (size_t w = 0; w < words; ++w) {
+            std::uint64_t matches = nameMask[w];
+            if (sizeMask) {
+                matches &= sizeMask[w] & mtimeMask[w];
+            }
+            if (matches) {
+                category = rules[w * 64 + static_cast<size_t>(__builtin_ctzll(matches))].target;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Built-in folders first, then each distinct rule target once
+    const std::string& folderName(Category category) const {
+        return folders[static_cast<size_t>(category)];
+    }
+    
+    const std::vector<std::string>& folderNames() const {
+        return folders;
+    }
+    
+    bool isCategoryFolder(std::string_view name) const {
+        return std::find(folders.begin(), folders.end(), name) != folders.end();
+    }
+
+private:
+    enum class Name { ext, glob, regex };
+    
+    template <typename T>
+    struct Range {
+        bool present = false;
+        T low = std::numeric_limits<T>::min();
+        T high = std::numeric_limits<T>::max();   // Inclusive
+    };
+    
+    struct Rule {
+        Category target = Category::Others;
+        int nameGroups[3] = {-1, -1, -1};         // One pattern group per Name kind, -1 when unused
+        Range<std::uintmax_t> size;
+        Range<std::int64_t> mtime;
+    };
+    
+    // Thompson NFA. Byte nodes consume one byte from their set, Split nodes
+    // are epsilon edges (alt is optional), Accept nodes report a group.
+    struct NfaNode {
+        enum Kind : std::uint8_t { Byte, Split, Accept } kind = Split;
+        std::bitset<256> bytes;
+        int next = -1;
+        int alt = -1;
+        int group = -1;
+    };
+    
+    struct Fragment {
+        int start = -1;
+        int end = -1;   // Split node whose next is still open
+    };
+    
+    template <typename T>
+    struct RangeTable {
+        bool used = false;
+        std::vector<T> bounds;                    // Sorted interval starts after the first
+        std::vector<std::uint64_t> masks;         // words per interval
+        std::vector<std::uint64_t> unconstrained; // Rules without this condition
+        
+        const std::uint64_t* lookup(T value, size_t words) const {
+            size_t interval = std::upper_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+            return &masks[interval * words];
+        }
+    };
+    
+    static const size_t maxDfaStates = 1 << 14;
+    
+    std::vector<std::string> folders;
+    std::uint64_t contentHash = 0xcbf29ce484222325ULL;
+    std::vector<Rule> rules;
+    size_t words = 0;
+    
+    std::vector<NfaNode> nfa;
+    std::vector<int> patternStarts;
+    size_t groupCount = 0;
+    
+    std::uint8_t byteClass[256] = {};
+    std::uint8_t representative[256] = {};      // One byte of each class
+    size_t classCount = 1;
+    std::vector<int> startSet;
+    
+    // DFA states are materialised lazily from NFA state sets as names walk
+    // into them and cached, so only the states real names reach are built.
+    // Workers follow transitions that already exist without locking: a
+    // state is complete before the transition leading to it is published,
+    // and it lives as long as the rule set. Only building a state takes
+    // matcherMutex. Past maxDfaStates nothing more is cached, and the rest
+    // of such a name is matched against the NFA directly, under the lock.
+    struct DfaState {
+        std::vector<int> nfaStates;
+        std::unique_ptr<std::atomic<std::int32_t>[]> next;   // Per byte class, -1 until computed
+        std::vector<std::uint64_t> mask;                     // Rules whose name conditions hold here
+    };
+    
+    mutable std::mutex matcherMutex;
+    mutable std::map<std::vector<int>, std::int32_t> stateIds;
+    mutable std::vector<std::unique_ptr<DfaState>> dfaStates;   // Sized once, so it never moves under readers
+    mutable size_t stateCount = 0;
+    mutable std::vector<std::uint32_t> seen;
+    mutable std::uint32_t pass = 0;
+    std::int32_t startState = 0;
+    
+    RangeTable<std::uintmax_t> sizeTable;
+    RangeTable<std::int64_t> mtimeTable;
+    
+    static std::string trim(const std::string& text) {
+        size_t first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos) {
+            return std::string();
+        }
+        size_t last = text.find_last_not_of(" \t\r\n");
+        return text.substr(first, last - first + 1);
+    }
+    
+    static std::string escapeGlob(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '*' || c == '?' || c == '[' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+    
+    Category folderId(const std::string& folder) {
+        auto it = std::find(folders.begin(), folders.end(), folder);
+        if (it == folders.end()) {
+            folders.push_back(folder);
+            it = folders.end() - 1;
+        }
+        return static_cast<Category>(it - folders.begin());
+    }
+    
+    void addPattern(Rule& rule, Name kind, Fragment pattern) {
+        if (pattern.start < 0) {
+            return;
+        }
+        int& group = rule.nameGroups[static_cast<int>(kind)];
+        if (group < 0) {
+            group = static_cast<int>(groupCount++);
+        }
+        int accept = node(NfaNode::Accept);
+        nfa[accept].group = group;
+        nfa[pattern.end].next = accept;
+        patternStarts.push_back(pattern.start);
+    }
+    
+    int node(NfaNode::Kind kind) {
+        nfa.emplace_back();
+        nfa.back().kind = kind;
+        return static_cast<int>(nfa.size() - 1);
+    }
+    
+    Fragment byteSet(const std::bitset<256>& bytes) {
+        int consume = node(NfaNode::Byte);
+        int end = node(NfaNode::Split);
+        nfa[consume].bytes = bytes;
+        nfa[consume].next = end;
+        return {consume, end};
+    }
+    
+    Fragment emptyFragment() {
+        int end = node(NfaNode::Split);
+        return {end, end};
+    }
+    
+    Fragment concat(Fragment first, Fragment second) {
+        nfa[first.end].next = second.start;
+        return {first.start, second.end};
+    }
+    
+    Fragment alternate(Fragment first, Fragment second) {
+        int split = node(NfaNode::Split);
+        int end = node(NfaNode::Split);
+        nfa[split].next = first.start;
+        nfa[split].alt = second.start;
+        nfa[first.end].next = end;
+        nfa[second.end].next = end;
+        return {split, end};
+    }
+    
+    // min 0 or 1 repetitions, optionally unbounded: ?, *, +
+    Fragment repeat(Fragment inner, bool atLeastOnce, bool unbounded) {
+        int split = node(NfaNode::Split);
+        int end = node(NfaNode::Split);
+        nfa[split].next = inner.start;
+        nfa[split].alt = end;
+        nfa[inner.end].next = unbounded ? split : end;
+        return {atLeastOnce ? inner.start : split, end};
+    }
+    
+    static std::bitset<256> anyByte() {
+        return std::bitset<256>().set();
+    }
+    
+    static std::bitset<256> literal(unsigned char c, bool foldCase) {
+        std::bitset<256> bytes;
+        bytes.set(c);
+        if (foldCase && std::isalpha(c)) {
+            bytes.set(static_cast<unsigned char>(std::tolower(c)));
+            bytes.set(static_cast<unsigned char>(std::toupper(c)));
+        }
+        return bytes;
+    }
+    
+    // Parses a [...] class starting after '['; position ends after ']'
+    static bool parseClass(const std::string& text, size_t& position, bool foldCase, bool regexEscapes,
+                           std::bitset<256>& bytes) {
+        bool negate = position < text.size() && (text[position] == '!' || text[position] == '^');
+        if (negate) {
+            ++position;
+        }
+        bool first = true;
+        while (position < text.size() && (text[position] != ']' || first)) {
+            first = false;
+            if (regexEscapes && text[position] == '\\' && position + 1 < text.size() &&
+                classEscape(text[position + 1], bytes)) {
+                position += 2;
+                continue;
+            }
+            if (text[position] == '\\' && position + 1 < text.size()) {
+                ++position;
+            }
+            unsigned char low = static_cast<unsigned char>(text[position++]);
+            unsigned char high = low;
+            if (position + 1 < text.size() && text[position] == '-' && text[position + 1] != ']') {
+                high = static_cast<unsigned char>(text[position + 1]);
+                position += 2;
+            }
+            for (int c = low; c <= high; ++c) {
+                bytes |= literal(static_cast<unsigned char>(c), foldCase);
+            }
+        }
+        if (position >= text.size()) {
+            return false;
+        }
+        ++position;
+        if (negate) {
+            bytes.flip();
+        }
+        return true;
+    }
+    
+    // \d \w \s and their negations
+    static bool classEscape(char escape, std::bitset<256>& bytes) {
+        if (escape != 'd' && escape != 'w' && escape != 's' && escape != 'D' && escape != 'W' && escape != 'S') {
+            return false;
+        }
+        std::bitset<256> set;
+        for (int c = 0; c < 256; ++c) {
+            char lower = static_cast<char>(std::tolower(escape));
+            bool member = (lower == 'd' && std::isdigit(c)) || (lower == 'w' && (std::isalnum(c) || c == '_')) ||
+                          (lower == 's' && std::isspace(c));
+            set[c] = member;
+        }
+        bytes |= std::isupper(static_cast<unsigned char>(escape)) ? ~set : set;
+        return true;
+    }
+    
+    // Globs match the whole name, case-insensitively: * ? [abc] [!a-z] \x
+    Fragment compileGlob(const std::string& glob, std::string& error) {
+        Fragment result = emptyFragment();
+        for (size_t i = 0; i < glob.size();) {
+            char c = glob[i++];
+            if (c == '*') {
+                result = concat(result, repeat(byteSet(anyByte()), false, true));
+            } else if (c == '?') {
+                result = concat(result, byteSet(anyByte()));
+            } else if (c == '[') {
+                std::bitset<256> bytes;
+                if (!parseClass(glob, i, true, false, bytes)) {
+                    error = "unterminated '[' in glob '" + glob + "'";
+                    return {};
+                }
+                result = concat(result, byteSet(bytes));
+            } else {
+                if (c == '\\' && i < glob.size()) {
+                    c = glob[i++];
+                }
+                result = concat(result, byteSet(literal(static_cast<unsigned char>(c), true)));
+            }
+        }
+        return result;
+    }
+    
+    // Regexes search the name unless anchored with ^ or $. Supported:
+    // literals, ., [...], \d \w \s, groups, |, *, + and ?
+    Fragment compileRegex(const std::string& regex, std::string& error) {
+        std::string body = regex;
+        bool anchoredStart = !body.empty() && body.front() == '^';
+        if (anchoredStart) {
+            body.erase(0, 1);
+        }
+        bool anchoredEnd = !body.empty() && body.back() == '$' &&
+                           (body.size() < 2 || body[body.size() - 2] != '\\');
+        if (anchoredEnd) {
+            body.pop_back();
+        }
+        
+        size_t position = 0;
+        Fragment result = parseAlternation(body, position, error);
+        if (error.empty() && position != body.size()) {
+            error = "unexpected ')'";
+        }
+        if (!error.empty()) {
+            error = "regex '" + regex + "': " + error;
+            return {};
+        }
+        if (!anchoredStart) {
+            result = concat(repeat(byteSet(anyByte()), false, true), result);
+        }
+        if (!anchoredEnd) {
+            result = concat(result, repeat(byteSet(anyByte()), false, true));
+        }
+        return result;
+    }
+    
+    Fragment parseAlternation(const std::string& text, size_t& position, std::string& error) {
+        Fragment result = parseSequence(text, position, error);
+        while (error.empty() && position < text.size() && text[position] == '|') {
+            ++position;
+            result = alternate(result, parseSequence(text, position, error));
+        }
+        return result;
+    }
+    
+    Fragment parseSequence(const std::string& text, size_t& position, std::string& error) {
+        Fragment result = emptyFragment();
+        while (error.empty() && position < text.size() && text[position] != '|' && text[position] != ')') {
+            Fragment atom = parseAtom(text, position, error);
+            while (error.empty() && position < text.size() &&
+                   (text[position] == '*' || text[position] == '+' || text[position] == '?')) {
+                char op = text[position++];
+                atom = repeat(atom, op == '+', op != '?');
+            }
+            if (position < text.size() && text[position] == '{') {
+                error = "counted repetition is not supported";
+            }
+            result = concat(result, atom);
+        }
+        return result;
+    }
+    
+    Fragment parseAtom(const std::string& text, size_t& position, std::string& error) {
+        char c = text[position++];
+        switch (c) {
+            case '(': {
+                if (text.compare(position, 2, "?:") == 0) {
+                    position += 2;
+                }
+                Fragment group = parseAlternation(text, position, error);
+                if (error.empty() && (position >= text.size() || text[position] != ')')) {
+                    error = "missing ')'";
+                }
+                ++position;
+                return group;
+            }
+            case '.':
+                return byteSet(anyByte());
+            case '[': {
+                std::bitset<256> bytes;
+                if (!parseClass(text, position, false, true, bytes)) {
+                    error = "unterminated '['";
+                }
+                return byteSet(bytes);
+            }
+            case '*': case '+': case '?': case '^': case '$':
+                error = std::string("unexpected '") + c + "'";
+                return emptyFragment();
+            case '\\': {
+                if (position >= text.size()) {
+                    error = "trailing '\\'";
+                    return emptyFragment();
+                }
+                std::bitset<256> bytes;
+                char escape = text[position++];
+                if (!classEscape(escape, bytes)) {
+                    bytes = literal(static_cast<unsigned char>(escape), false);
+                }
+                return byteSet(bytes);
+            }
+            default:
+                return byteSet(literal(static_cast<unsigned char>(c), false));
+        }
+    }
+    
+    // Epsilon closure, keeping only the nodes that consume or accept. Nodes
+    // stamped with the current pass number have already been visited.
+    void closure(std::vector<int>& work, std::vector<int>& states, std::vector<std::uint32_t>& seen,
+                 std::uint32_t pass) const {
+        while (!work.empty()) {
+            int current = work.back();
+            work.pop_back();
+            if (current < 0 || seen[current] == pass) {
+                continue;
+            }
+            seen[current] = pass;
+            const NfaNode& n = nfa[current];
+            if (n.kind == NfaNode::Split) {
+                work.push_back(n.next);
+                work.push_back(n.alt);
+            } else {
+                states.push_back(current);
+            }
+        }
+        std::sort(states.begin(), states.end());
+    }
+    
+    // Partitions the 256 byte values into classes no pattern distinguishes
+    void buildByteClasses() {
+        classCount = 1;
+        std::fill(std::begin(byteClass), std::end(byteClass), 0);
+        for (const NfaNode& n : nfa) {
+            if (n.kind != NfaNode::Byte) {
+                continue;
+            }
+            std::map<std::pair<int, bool>, int> split;
+            int next = 0;
+            for (int c = 0; c < 256; ++c) {
+                auto key = std::make_pair(int(byteClass[c]), bool(n.bytes[c]));
+                auto it = split.emplace(key, next).first;
+                if (it->second == next) {
+                    ++next;
+                }
+                byteClass[c] = static_cast<std::uint8_t>(it->second);
+            }
+            classCount = static_cast<size_t>(next);
+        }
+    }
+    
+    void buildMatcher() {
+        buildByteClasses();
+        for (int c = 255; c >= 0; --c) {
+            representative[byteClass[c]] = static_cast<std::uint8_t>(c);
+        }
+        seen.assign(nfa.size(), 0);
+        std::vector<int> work(patternStarts.rbegin(), patternStarts.rend());
+        closure(work, startSet, seen, ++pass);
+        
+        stateIds.clear();
+        dfaStates.clear();
+        dfaStates.resize(maxDfaStates);
+        stateCount = 0;
+        startState = addState(startSet);
+    }
+    
+    // Walks the DFA over a name and returns the rule mask it ends in. When
+    // the name leaves the cached states the mask is built in `uncached`.
+    const std::uint64_t* matchName(std::string_view filename, std::vector<std::uint64_t>& uncached) const {
+        std::int32_t state = startState;
+        for (size_t i = 0; i < filename.size(); ++i) {
+            size_t cls = byteClass[static_cast<unsigned char>(filename[i])];
+            std::int32_t next = dfaStates[state]->next[cls].load(std::memory_order_acquire);
+            if (next < 0) {
+                std::lock_guard<std::mutex> lock(matcherMutex);
+                next = step(state, cls);
+                if (next < 0) {
+                    std::vector<int> current = dfaStates[state]->nfaStates;
+                    for (; i < filename.size(); ++i) {
+                        current = advance(current, byteClass[static_cast<unsigned char>(filename[i])]);
+                    }
+                    uncached = maskFor(current);
+                    return uncached.data();
+                }
+            }
+            state = next;
+        }
+        return dfaStates[state]->mask.data();
+    }
+    
+    // Called under matcherMutex. Returns -1 when the cache is full.
+    std::int32_t addState(const std::vector<int>& states) const {
+        auto found = stateIds.find(states);
+        if (found != stateIds.end()) {
+            return found->second;
+        }
+        if (stateCount == dfaStates.size()) {
+            return -1;
+        }
+        auto state = std::make_unique<DfaState>();
+        state->nfaStates = states;
+        state->next.reset(new std::atomic<std::int32_t>[classCount]);
+        for (size_t c = 0; c < classCount; ++c) {
+            state->next[c].store(-1, std::memory_order_relaxed);
+        }
+        state->mask = maskFor(states);
+        std::int32_t id = static_cast<std::int32_t>(stateCount++);
+        dfaStates[static_cast<size_t>(id)] = std::move(state);
+        stateIds.emplace(states, id);
+        return id;
+    }
+    
+    // Which rules have every name condition satisfied if the name ends here
+    std::vector<std::uint64_t> maskFor(const std::vector<int>& states) const {
+        std::vector<char> matched(groupCount, 0);
+        for (int n : states) {
+            if (nfa[n].kind == NfaNode::Accept) {
+                matched[nfa[n].group] = 1;
+            }
+        }
+        std::vector<std::uint64_t> mask(words, 0);
+        for (size_t r = 0; r < rules.size(); ++r) {
+            bool all = true;
+            for (int group : rules[r].nameGroups) {
+                all = all && (group < 0 || matched[group]);
+            }
+            if (all) {
+                mask[r / 64] |= std::uint64_t(1) << (r % 64);
+            }
+        }
+        return mask;
+    }
+    
+    // Called under matcherMutex
+    std::vector<int> advance(const std::vector<int>& states, size_t cls) const {
+        std::vector<int> work;
+        std::vector<int> next;
+        for (int n : states) {
+            if (nfa[n].kind == NfaNode::Byte && nfa[n].bytes[representative[cls]]) {
+                work.push_back(nfa[n].next);
+            }
+        }
+        closure(work, next, seen, ++pass);
+        return next;
+    }
+    
+    // Called under matcherMutex. Another worker may have built the
+    // transition while this one waited for the lock.
+    std::int32_t step(std::int32_t state, size_t cls) const {
+        DfaState& from = *dfaStates[static_cast<size_t>(state)];
+        std::int32_t cached = from.next[cls].load(std::memory_order_relaxed);
+        if (cached >= 0) {
+            return cached;
+        }
+        std::int32_t target = addState(advance(from.nfaStates, cls));
+        if (target >= 0) {
+            from.next[cls].store(target, std::memory_order_release);
+        }
+        return target;
+    }
+    
+    template <typename T>
+    RangeTable<T> buildRangeTable(Range<T> Rule::*member) const {
+        RangeTable<T> table;
+        table.unconstrained.assign(words, 0);
+        for (size_t r = 0; r < rules.size(); ++r) {
+            const Range<T>& range = rules[r].*member;
+            if (range.present) {
+                table.used = true;
+                table.bounds.push_back(range.low);
+                if (range.high != std::numeric_limits<T>::max()) {
+                    table.bounds.push_back(range.high + 1);
+                }
+            } else {
+                table.unconstrained[r / 64] |= std::uint64_t(1) << (r % 64);
+            }
+        }
+        std::sort(table.bounds.begin(), table.bounds.end());
+        table.bounds.erase(std::unique(table.bounds.begin(), table.bounds.end()), table.bounds.end());
+        
+        // Interval i starts at bounds[i - 1]; every rule either covers it or not
+        size_t intervals = table.bounds.size() + 1;
+        table.masks.assign(intervals * words, 0);
+        for (size_t i = 0; i < intervals; ++i) {
+            T start = i == 0 ? std::numeric_limits<T>::min() : table.bounds[i - 1];
+            for (size_t r = 0; r < rules.size(); ++r) {
+                const Range<T>& range = rules[r].*member;
+                if (!range.present || (range.low <= start && start <= range.high)) {
+                    table.masks[i * words + r / 64] |= std::uint64_t(1) << (r % 64);
+                }
+            }
+        }
+        return table;
+    }
+    
+    template <typename T, typename Parse>
+    static bool parseRange(const std::string& text, Parse parse, Range<T>& range) {
+        size_t dots = text.find("..");
+        if (dots == std::string::npos) {
+            return false;
+        }
+        std::string low = trim(text.substr(0, dots));
+        std::string high = trim(text.substr(dots + 2));
+        if ((!low.empty() && !parse(low, range.low)) || (!high.empty() && !parse(high, range.high)) ||
+            range.low > range.high) {
+            return false;
+        }
+        range.present = true;
+        return true;
+    }
+    
+    // 512, 10K, 1.5M, 2G (powers of 1024)
+    static bool parseSize(const std::string& text, std::uintmax_t& size) {
+        char* end = nullptr;
+        double value = std::strtod(text.c_str(), &end);
+        std::string unit = trim(end);
+        double scale = 1;
+        if (!unit.empty() && (unit.back() == 'B' || unit.back() == 'b')) {
+            unit.pop_back();
+        }
+        if (unit.size() > 1 || end == text.c_str() || value < 0) {
+            return false;
+        }
+        if (!unit.empty()) {
+            size_t power = std::string("KMGT").find(static_cast<char>(std::toupper(unit[0])));
+            if (power == std::string::npos) {
+                return false;
+            }
+            scale = static_cast<double>(std::uint64_t(1) << (10 * (power + 1)));
+        }
+        size = static_cast<std::uintmax_t>(value * scale);
+        return true;
+    }
+    
+    // YYYY-MM-DD, local midnight
+    static bool parseDate(const std::string& text, std::int64_t& seconds) {
+        std::tm date = {};
+        std::istringstream input(text);
+        input >> std::get_time(&date, "%Y-%m-%d");
+        if (input.fail()) {
+            return false;
+        }
+        date.tm_isdst = -1;
+        std::time_t value = std::mktime(&date);
+        if (value == static_cast<std::time_t>(-1)) {
+            return false;
+        }
+        seconds = static_cast<std::int64_t>(value);
+        return true;
+    }
+};
+
+// Content-based file type detection for --sniff. The first sniffWindow
+// bytes of a file are checked against known signatures: fixed-offset magic
+// numbers first, then a multi-pattern search for container markers (ZIP
+// based Office/OpenDocument files, Ogg Theora video).
+class ContentSniffer {
+public:
+    static const size_t sniffWindow = 512;
+    
+    // Returns the category implied by the file header, or Others when the
+    // content is not recognised and the extension should decide. byName is
+    // the category the file's name gives it, which settles generic ISO
+    // media files that could hold either audio or video.
+    static Category classify(const unsigned char* data, size_t size, Category byName = Category::Others) {
+        auto startsWith = [&](size_t offset, const char* magic, size_t length) {
+            return size >= offset + length && std::memcmp(data + offset, magic, length) == 0;
+        };
+        
+        if (startsWith(0, "\xFF\xD8\xFF", 3) || startsWith(0, "\x89PNG\r\n\x1A\n", 8) ||
+            startsWith(0, "GIF87a", 6) || startsWith(0, "GIF89a", 6) ||
+            (startsWith(0, "RIFF", 4) && startsWith(8, "WEBP", 4))) {
+            return Category::Images;
+        }
+        if (startsWith(0, "%PDF-", 5)) {
+            return Category::Documents;
+        }
+        if (startsWith(4, "ftyp", 4) && size >= 12) {
+            return classifyIsoMedia(data, size, byName);
+        }
+        if (startsWith(0, "\x1A\x45\xDF\xA3", 4) || (startsWith(0, "RIFF", 4) && startsWith(8, "AVI ", 4))) {
+            return Category::Videos;
+        }
+        if (startsWith(0, "fLaC", 4) || startsWith(0, "ID3", 3) ||
+            (startsWith(0, "RIFF", 4) && startsWith(8, "WAVE", 4))) {
+            return Category::Music;
+        }
+        if (startsWith(0, "OggS", 4)) {
+            return findAny(data, size, oggVideoMarkers) ? Category::Videos : Category::Music;
+        }
+        if (startsWith(0, "PK\x03\x04", 4) && findAny(data, size, officeMarkers)) {
+            return Category::Documents;
+        }
+        return Category::Others;
+    }
+    
+    // Sniffs a batch of files. Every file is opened and given a readahead
+    // hint before the first header is read, so the kernel can fetch the
+    // headers concurrently instead of one synchronous read at a time.
+    // byName holds each file's category from its name (see classify()).
+    static std::vector<Category> classifyFiles(const std::vector<fs::path>& paths,
+                                               const std::vector<Category>& byName) {
+        std::vector<Category> categories(paths.size(), Category::Others);
+        std::vector<unsigned char> buffer(sniffWindow);
+#ifndef _WIN32
+        std::vector<int> fds(paths.size(), -1);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            fds[i] = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+#ifdef POSIX_FADV_WILLNEED
+            if (fds[i] >= 0) {
+                posix_fadvise(fds[i], 0, sniffWindow, POSIX_FADV_WILLNEED);
+            }
+#endif
+        }
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            ssize_t bytesRead = pread(fds[i], buffer.data(), buffer.size(), 0);
+            if (bytesRead > 0) {
+                categories[i] = classify(buffer.data(), static_cast<size_t>(bytesRead), byName[i]);
+            }
+            close(fds[i]);
+        }
+#else
+        for (size_t i = 0; i < paths.size(); ++i) {
+            std::ifstream file(paths[i], std::ios::binary);
+            file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+            if (file.gcount() > 0) {
+                categories[i] = classify(buffer.data(), static_cast<size_t>(file.gcount()), byName[i]);
+            }
+        }
+#endif
+        return categories;
+    }
+    
+    static Category classifyFile(const fs::path& path, Category byName) {
+        return classifyFiles({path}, {byName}).front();
+    }
+
+private:
+    struct Pattern {
+        const char* bytes;
+        size_t length;
+    };
+    
+    inline static const std::vector<Pattern> officeMarkers = {
+        {"[Content_Types].xml", 19}, {"word/", 5}, {"xl/", 3}, {"ppt/", 4},
+        {"mimetypeapplication/vnd.oasis.opendocument", 43}, {"mimetypeapplication/epub+zip", 28}
+    };
+    inline static const std::vector<Pattern> oggVideoMarkers = {
+        {"\x80theora", 7}
+    };
+    
+    // ISO base media brands that say what the file holds; anything else
+    // (isom, mp41, mp42, dash, ...) is generic
+    inline static const std::vector<std::string_view> imageBrands = {
+        "heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "mif2", "msf1", "avif", "avis"
+    };
+    inline static const std::vector<std::string_view> audioBrands = {
+        "M4A ", "M4B ", "M4P ", "F4A ", "F4B "
+    };
+    inline static const std::vector<std::string_view> videoBrands = {
+        "M4V ", "M4VH", "M4VP", "qt  ", "3gp4", "3gp5", "3gp6", "3g2a", "F4V ", "F4P "
+    };
+    
+    // Decides from the major brand, then from the compatible brands listed
+    // in the ftyp box. HEIF and AVIF stills are photos. A file with only
+    // generic brands keeps an audio or video category from its name and is
+    // otherwise taken for video.
+    static Category classifyIsoMedia(const unsigned char* data, size_t size, Category byName) {
+        auto brandAt = [&](size_t offset) {
+            return std::string_view(reinterpret_cast<const char*>(data) + offset, 4);
+        };
+        auto known = [](std::string_view brand) {
+            auto in = [&](const std::vector<std::string_view>& brands) {
+                return std::find(brands.begin(), brands.end(), brand) != brands.end();
+            };
+            return in(imageBrands) ? Category::Images : in(audioBrands) ? Category::Music
+                 : in(videoBrands) ? Category::Videos : Category::Others;
+        };
+        
+        Category major = known(brandAt(8));
+        if (major != Category::Others) {
+            return major;
+        }
+        // Compatible brands follow the minor version, up to the end of the box
+        size_t boxEnd = std::min<size_t>(size, (size_t(data[0]) << 24) | (size_t(data[1]) << 16) |
+                                               (size_t(data[2]) << 8) | size_t(data[3]));
+        Category compatible = Category::Others;
+        for (size_t offset = 16; offset + 4 <= boxEnd; offset += 4) {
+            Category category = known(brandAt(offset));
+            if (category == Category::Images) {
+                return category;
+            }
+            if (compatible == Category::Others) {
+                compatible = category;
+            }
+        }
+        if (compatible != Category::Others) {
+            return compatible;
+        }
+        return byName == Category::Music || byName == Category::Videos ? byName : Category::Videos;
+    }
+    
+    // True when any pattern occurs in data. Candidate positions are found
+    // by comparing 16 bytes at a time against every distinct first byte of
+    // the pattern set (SSE2 where available); only those positions are
+    // verified with memcmp.
+    static bool findAny(const unsigned char* data, size_t size, const std::vector<Pattern>& patterns) {
+        unsigned char firstBytes[16];
+        size_t firstCount = 0;
+        for (const auto& pattern : patterns) {
+            unsigned char first = static_cast<unsigned char>(pattern.bytes[0]);
+            if (std::find(firstBytes, firstBytes + firstCount, first) == firstBytes + firstCount && firstCount < 16) {
+                firstBytes[firstCount++] = first;
+            }
+        }
+        
+        auto matchAt = [&](size_t position) {
+            for (const auto& pattern : patterns) {
+                if (size - position >= pattern.length && std::memcmp(data + position, pattern.bytes, pattern.length) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        
+        size_t position = 0;
+#ifdef __SSE2__
+        __m128i needles[16];
+        for (size_t i = 0; i < firstCount; ++i) {
+            needles[i] = _mm_set1_epi8(static_cast<char>(firstBytes[i]));
+        }
+        for (; position + 16 <= size; position += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+            int mask = 0;
+            for (size_t i = 0; i < firstCount; ++i) {
+                mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(block, needles[i]));
+            }
+            while (mask) {
+                int bit = __builtin_ctz(static_cast<unsigned>(mask));
+                if (matchAt(position + bit)) {
+                    return true;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; position < size; ++position) {
+            if (std::find(firstBytes, firstBytes + firstCount, data[position]) != firstBytes + firstCount &&
+                matchAt(position)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// XXH64 of one buffer. Four independent lanes keep the multiplier units
+// busy, so hashing runs at memory speed.
+std::uint64_t xxh64(const char* data, size_t length, std::uint64_t seed) {
+    const std::uint64_t prime1 = 11400714785074694791ULL;
+    const std::uint64_t prime2 = 14029467366897019727ULL;
+    const std::uint64_t prime3 = 1609587929392839161ULL;
+    const std::uint64_t prime4 = 9650029242287828579ULL;
+    const std::uint64_t prime5 = 2870177450012600261ULL;
+    auto rotate = [](std::uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto round = [&](std::uint64_t accumulator, std::uint64_t input) {
+        return rotate(accumulator + input * prime2, 31) * prime1;
+    };
+    auto merge = [&](std::uint64_t hash, std::uint64_t lane) {
+        return (hash ^ round(0, lane)) * prime1 + prime4;
+    };
+    
+    const char* end = data + length;
+    std::uint64_t hash;
+    if (length >= 32) {
+        std::uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for (; end - data >= 32; data += 32) {
+            for (int lane = 0; lane < 4; ++lane) {
+                lanes[lane] = round(lanes[lane], getU64(data + lane * 8));
+            }
+        }
+        hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+        for (std::uint64_t lane : lanes) {
+            hash = merge(hash, lane);
+        }
+    } else {
+        hash = seed + prime5;
+    }
+    hash += length;
+    
+    for (; end - data >= 8; data += 8) {
+        hash = rotate(hash ^ round(0, getU64(data)), 27) * prime1 + prime4;
+    }
+    if (end - data >= 4) {
+        hash = rotate(hash ^ (getU32(data) * prime1), 23) * prime2 + prime3;
+        data += 4;
+    }
+    for (; data < end; ++data) {
+        hash = rotate(hash ^ (static_cast<unsigned char>(*data) * prime5), 11) * prime1;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Reads when a photo or video was taken, for --layout date. Only small
+// windows of a file are mapped: its first 64 KB, which hold a JPEG's or
+// TIFF's EXIF block, and for ISO media (MP4/MOV) the start of the moov box,
+// found by hopping over the top-level box headers. Files without a usable
+// date fall back to their modification time.
+class MediaDateReader {
+public:
+    static const size_t headerWindow = 64 * 1024;
+    
+    // Capture year and month as yyyymm (202610), or 0 when nothing is known
+    static std::uint32_t captureMonth(const fs::path& path) {
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+        struct stat info;
+        std::uint32_t month = 0;
+        if (fstat(fd, &info) == 0) {
+            month = info.st_size > 0 ? headerMonth(fd, static_cast<std::uint64_t>(info.st_size)) : 0;
+            if (month == 0) {
+                month = monthOf(info.st_mtime);
+            }
+        }
+        close(fd);
+        return month;
+#else
+        std::error_code ec;
+        std::uintmax_t size = fs::file_size(path, ec);
+        std::ifstream file(path, std::ios::binary);
+        std::uint32_t month = !ec && size > 0 && file ? headerMonth(file, size) : 0;
+        if (month == 0) {
+            auto written = fs::last_write_time(path, ec);
+            if (ec) {
+                return 0;
+            }
+            auto systemTime = std::chrono::system_clock::now() +
+                              std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                  written - fs::file_time_type::clock::now());
+            month = monthOf(std::chrono::duration_cast<std::chrono::seconds>(systemTime.time_since_epoch()).count());
+        }
+        return month;
+#endif
+    }
+    
+    // Date of an EXIF block in TIFF layout ("II*\0" or "MM\0*"): the
+    // DateTimeOriginal or DateTimeDigitized tag, else IFD0's DateTime
+    static std::uint32_t tiffMonth(const unsigned char* tiff, size_t size) {
+        if (size < 8 || (std::memcmp(tiff, "II*\0", 4) != 0 && std::memcmp(tiff, "MM\0*", 4) != 0)) {
+            return 0;
+        }
+        bool little = tiff[0] == 'I';
+        auto u16 = [&](size_t at) -> std::uint32_t {
+            return little ? tiff[at] | tiff[at + 1] << 8 : tiff[at] << 8 | tiff[at + 1];
+        };
+        auto u32 = [&](size_t at) -> std::uint32_t {
+            return little ? u16(at) | u16(at + 2) << 16 : u16(at) << 16 | u16(at + 2);
+        };
+        // Position of `tag`'s value field in the IFD at `ifd`, or 0
+        auto find = [&](size_t ifd, std::uint32_t tag) -> size_t {
+            if (ifd + 2 > size) {
+                return 0;
+            }
+            size_t count = u16(ifd);
+            for (size_t entry = ifd + 2; entry + 12 <= size && count > 0; entry += 12, --count) {
+                if (u16(entry) == tag) {
+                    return entry + 8;
+                }
+            }
+            return 0;
+        };
+        // Dates are "YYYY:MM:DD HH:MM:SS", too long to sit in the value field
+        auto dateAt = [&](size_t valueAt) -> std::uint32_t {
+            size_t at = valueAt ? u32(valueAt) : 0;
+            return at > 0 && at + 7 <= size ? parseMonth(tiff + at) : 0;
+        };
+        size_t ifd0 = u32(4);
+        if (size_t exifPointer = find(ifd0, 0x8769)) {
+            size_t exifIfd = u32(exifPointer);
+            if (std::uint32_t month = dateAt(find(exifIfd, 0x9003))) {
+                return month;
+            }
+            if (std::uint32_t month = dateAt(find(exifIfd, 0x9004))) {
+                return month;
+            }
+        }
+        return dateAt(find(ifd0, 0x0132));
+    }
+    
+    // Date of the EXIF block in a JPEG's APP1 segment
+    static std::uint32_t jpegMonth(const unsigned char* data, size_t size) {
+        size_t at = 2;
+        while (at + 4 <= size && data[at] == 0xFF) {
+            unsigned char marker = data[at + 1];
+            if (marker == 0xDA || marker == 0xD9) {
+                break;   // Image data follows; metadata comes before it
+            }
+            size_t length = static_cast<size_t>(data[at + 2]) << 8 | data[at + 3];
+            if (marker == 0xE1 && length >= 8 && at + 10 <= size && std::memcmp(data + at + 4, "Exif\0\0", 6) == 0) {
+                return tiffMonth(data + at + 10, std::min(length - 8, size - (at + 10)));
+            }
+            at += 2 + length;
+        }
+        return 0;
+    }
+    
+    // Creation time in a moov box's mvhd child, seconds since 1904 (UTC)
+    static std::uint32_t moovMonth(const unsigned char* data, size_t size) {
+        for (size_t at = 0; at + 8 <= size;) {
+            std::uint64_t boxSize = be32(data + at);
+            if (std::memcmp(data + at + 4, "mvhd", 4) == 0) {
+                std::uint64_t created = 0;
+                if (at + 16 <= size && data[at + 8] == 0) {
+                    created = be32(data + at + 12);
+                } else if (at + 20 <= size && data[at + 8] == 1) {
+                    created = static_cast<std::uint64_t>(be32(data + at + 12)) << 32 | be32(data + at + 16);
+                }
+                const std::uint64_t unixEpoch = 2082844800;   // 1970-01-01 in the 1904 epoch
+                return created > unixEpoch ? monthOf(static_cast<std::int64_t>(created - unixEpoch)) : 0;
+            }
+            if (boxSize < 8) {
+                break;
+            }
+            at += boxSize;
+        }
+        return 0;
+    }
+
+private:
+    // A read-only view of [offset, offset + length) of a file. On Linux the
+    // range is mapped, page-aligned, so the header is never copied.
+    class Window {
+    public:
+#ifdef __linux__
+        Window(int fd, std::uint64_t offset, size_t length) {
+            static const std::uint64_t pageSize = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+            std::uint64_t start = offset - offset % pageSize;
+            mappedBytes = length + static_cast<size_t>(offset - start);
+            void* region = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(start));
+            if (region != MAP_FAILED) {
+                mapping = region;
+                data = static_cast<const unsigned char*>(region) + (offset - start);
+                size = length;
+            }
+        }
+        
+        ~Window() {
+            if (mapping) {
+                munmap(mapping, mappedBytes);
+            }
+        }
+#else
+        Window(std::ifstream& file, std::uint64_t offset, size_t length) : buffer(length) {
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(offset));
+            file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(length));
+            data = buffer.data();
+            size = static_cast<size_t>(file.gcount());
+        }
+#endif
+        
+        Window(const Window&) = delete;
+        Window& operator=(const Window&) = delete;
+        
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+    
+    private:
+#ifdef __linux__
+        void* mapping = nullptr;
+        size_t mappedBytes = 0;
+#else
+        std::vector<unsigned char> buffer;
+#endif
+    };
+    
+    static std::uint32_t be32(const unsigned char* bytes) {
+        return static_cast<std::uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+    }
+    
+    template <typename Source>
+    static std::uint32_t headerMonth(Source& source, std::uint64_t fileSize) {
+        Window head(source, 0, static_cast<size_t>(std::min<std::uint64_t>(fileSize, headerWindow)));
+        if (head.size < 12) {
+            return 0;
+        }
+        if (head.data[0] == 0xFF && head.data[1] == 0xD8) {
+            return jpegMonth(head.data, head.size);
+        }
+        if (std::memcmp(head.data + 4, "ftyp", 4) != 0) {
+            return tiffMonth(head.data, head.size);
+        }
+        
+        // ISO media: hop over top-level boxes (mdat is often first and huge)
+        // until moov, then look at its first window
+        std::uint64_t at = 0;
+        for (int boxes = 0; boxes < 64 && at + 16 <= fileSize; ++boxes) {
+            unsigned char header[16];
+            if (at + 16 <= head.size) {
+                std::memcpy(header, head.data + at, 16);
+            } else {
+                Window box(source, at, 16);
+                if (box.size < 16) {
+                    return 0;
+                }
+                std::memcpy(header, box.data, 16);
+            }
+            std::uint64_t boxSize = be32(header);
+            std::uint64_t headerSize = 8;
+            if (boxSize == 1) {
+                boxSize = static_cast<std::uint64_t>(be32(header + 8)) << 32 | be32(header + 12);
+                headerSize = 16;
+            } else if (boxSize == 0) {
+                boxSize = fileSize - at;
+            }
+            if (boxSize < headerSize || boxSize > fileSize - at) {
+                return 0;
+            }
+            if (std::memcmp(header + 4, "moov", 4) == 0) {
+                std::uint64_t body = at + headerSize;
+                size_t length = static_cast<size_t>(std::min<std::uint64_t>(boxSize - headerSize, headerWindow));
+                if (body + length <= head.size) {
+                    return moovMonth(head.data + body, length);
+                }
+                Window moov(source, body, length);
+                return moov.data ? moovMonth(moov.data, moov.size) : 0;
+            }
+            at += boxSize;
+        }
+        return 0;
+    }
+    
+    // "YYYY:MM..." to yyyymm; all-zero placeholder dates are rejected
+    static std::uint32_t parseMonth(const unsigned char* text) {
+        for (size_t i : {0, 1, 2, 3, 5, 6}) {
+            if (!std::isdigit(text[i])) {
+                return 0;
+            }
+        }
+        std::uint32_t year = (text[0] - '0') * 1000 + (text[1] - '0') * 100 + (text[2] - '0') * 10 + (text[3] - '0');
+        std::uint32_t month = (text[5] - '0') * 10 + (text[6] - '0');
+        return year >= 1900 && month >= 1 && month <= 12 ? year * 100 + month : 0;
+    }
+    
+    // Local year and month of a Unix time
+    static std::uint32_t monthOf(std::int64_t seconds) {
+        std::time_t time = static_cast<std::time_t>(seconds);
+        std::tm local{};
+#ifdef _WIN32
+        if (localtime_s(&local, &time) != 0) {
+            return 0;
+        }
+#else
+        if (!localtime_r(&time, &local)) {
+            return 0;
+        }
+#endif
+        return static_cast<std::uint32_t>(local.tm_year + 1900) * 100 + static_cast<std::uint32_t>(local.tm_mon + 1);
+    }
+};
+
+// Finds byte-identical files for --dedupe in tiers, each applied only to
+// the groups the previous one left with more than one member:
+//   1. size (one stat per file)
+//   2. a hash of the first and last block
+//   3. a hash of the whole file, streamed through mmap
+//   4. optionally a byte-by-byte comparison with the kept copy
+// so files with a unique size or a distinct head/tail are never read in
+// full. Each tier runs in parallel over the files it has to look at.
+class DuplicateFinder {
+public:
+    static const size_t none = static_cast<size_t>(-1);
+    
+    // For every path, the index of the first earlier path with the same
+    // contents, or none. Empty and unreadable files never match.
+    static std::vector<size_t> find(const std::vector<fs::path>& paths, int jobs, bool verify) {
+        std::vector<std::uintmax_t> sizes(paths.size(), 0);
+        runParallel(paths.size(), jobs, [&](size_t i) {
+            std::error_code ec;
+            std::uintmax_t size = fs::file_size(paths[i], ec);
+            sizes[i] = ec ? 0 : size;
+        });
+        
+        std::vector<std::vector<size_t>> groups;
+        {
+            std::unordered_map<std::uintmax_t, std::vector<size_t>> bySize;
+            for (size_t i = 0; i < paths.size(); ++i) {
+                if (sizes[i] > 0) {
+                    bySize[sizes[i]].push_back(i);
+                }
+            }
+            for (auto& group : bySize) {
+                if (group.second.size() > 1) {
+                    groups.push_back(std::move(group.second));
+                }
+            }
+        }
+        
+        groups = refine(groups, jobs, [&](size_t i, std::uint64_t& key) {
+            return partialHash(paths[i], sizes[i], key);
+        });
+        groups = refine(groups, jobs, [&](size_t i, std::uint64_t& key) {
+            if (sizes[i] <= 2 * blockSize) {
+                key = 0;   // The partial hash already covered the whole file
+                return true;
+            }
+            return contentHash(paths[i], key);
+        });
+        
+        std::vector<size_t> original(paths.size(), none);
+        for (auto& group : groups) {
+            std::sort(group.begin(), group.end());
+            for (size_t member = 1; member < group.size(); ++member) {
+                original[group[member]] = group.front();
+            }
+        }
+        if (verify) {
+            runParallel(paths.size(), jobs, [&](size_t i) {
+                if (original[i] != none && !sameContents(paths[original[i]], paths[i])) {
+                    original[i] = none;
+                }
+            });
+        }
+        return original;
+    }
+    
+    // Hash of a whole file: chained 1 MB chunk hashes, so mapped and
+    // buffered reads agree
+    static bool contentHash(const fs::path& path, std::uint64_t& key) {
+        key = 0;
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        void* mapping = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        madvise(mapping, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        const char* data = static_cast<const char*>(mapping);
+        for (size_t offset = 0; offset < static_cast<size_t>(info.st_size); offset += chunkSize) {
+            key = xxh64(data + offset, std::min<size_t>(chunkSize, info.st_size - offset), key);
+        }
+        munmap(mapping, static_cast<size_t>(info.st_size));
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> chunk(chunkSize);
+        while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0) {
+            key = xxh64(chunk.data(), static_cast<size_t>(file.gcount()), key);
+        }
+        return file.eof();
+#endif
+    }
+
+private:
+    static const size_t blockSize = 4096;
+    static const size_t chunkSize = 1 << 20;
+    
+    // Splits every group by key(i), dropping members whose key could not be
+    // computed and groups left with a single member
+    template <typename Key>
+    static std::vector<std::vector<size_t>> refine(const std::vector<std::vector<size_t>>& groups, int jobs, Key key) {
+        std::vector<size_t> members;
+        for (const auto& group : groups) {
+            members.insert(members.end(), group.begin(), group.end());
+        }
+        std::vector<std::uint64_t> keys(members.size());
+        std::vector<char> valid(members.size(), 0);
+        runParallel(members.size(), jobs, [&](size_t i) {
+            valid[i] = key(members[i], keys[i]);
+        });
+        
+        std::vector<std::vector<size_t>> refined;
+        size_t position = 0;
+        for (const auto& group : groups) {
+            std::unordered_map<std::uint64_t, std::vector<size_t>> byKey;
+            for (size_t member : group) {
+                if (valid[position]) {
+                    byKey[keys[position]].push_back(member);
+                }
+                ++position;
+            }
+            for (auto& split : byKey) {
+                if (split.second.size() > 1) {
+                    refined.push_back(std::move(split.second));
+                }
+            }
+        }
+        return refined;
+    }
+    
+    static bool partialHash(const fs::path& path, std::uintmax_t size, std::uint64_t& key) {
+        std::string head(std::min<std::uintmax_t>(size, blockSize), '\0');
+        std::string tail(size > blockSize ? std::min<std::uintmax_t>(size - blockSize, blockSize) : 0, '\0');
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = pread(fd, &head[0], head.size(), 0) == static_cast<ssize_t>(head.size()) &&
+                  (tail.empty() || pread(fd, &tail[0], tail.size(), size - tail.size()) == static_cast<ssize_t>(tail.size()));
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        bool ok = file.read(&head[0], head.size()) &&
+                  (tail.empty() || (file.seekg(size - tail.size()) && file.read(&tail[0], tail.size())));
+#endif
+        key = xxh64(tail.data(), tail.size(), xxh64(head.data(), head.size(), size));
+        return ok;
+    }
+    
+    static bool sameContents(const fs::path& first, const fs::path& second) {
+        std::ifstream a(first, std::ios::binary);
+        std::ifstream b(second, std::ios::binary);
+        std::vector<char> left(chunkSize);
+        std::vector<char> right(chunkSize);
+        while (a && b) {
+            a.read(left.data(), left.size());
+            b.read(right.data(), right.size());
+            if (a.gcount() != b.gcount() || std::memcmp(left.data(), right.data(), a.gcount()) != 0) {
+                return false;
+            }
+        }
+        return a.eof() && b.eof();
+    }
+};
+
+#ifdef __linux__
+// Copies [offset, end) of one file into the same range of another with
+// copy_file_range, which lets the kernel (or a network server) move the
+// data without a round trip through user space
+bool copyFileRange(int from, int to, std::uint64_t offset, std::uint64_t end, int& error) {
+#ifdef SYS_copy_file_range
+    loff_t in = static_cast<loff_t>(offset);
+    loff_t out = static_cast<loff_t>(offset);
+    while (static_cast<std::uint64_t>(in) < end) {
+        std::uint64_t piece = IoThrottle::copyPiece(end - static_cast<std::uint64_t>(in));
+        IoThrottle::bytes(piece);
+        ssize_t copied = syscall(SYS_copy_file_range, from, &in, to, &out, static_cast<size_t>(piece), 0);
+        if (copied <= 0) {
+            error = copied == 0 ? EIO : errno;
+            return false;
+        }
+    }
+    return true;
+#else
+    (void)from, (void)to, (void)offset, (void)end;
+    error = ENOSYS;
+    return false;
+#endif
+}
+
+// Copies the whole of `from` into `to`, trying in order a reflink (no data
+// copied at all), copy_file_range (split over `jobs` threads for large
+// files), sendfile, and finally plain reads and writes
+bool copyFileData(int from, int to, std::uint64_t size, int jobs, bool& cloned, int& error) {
+    cloned = ioctl(to, FICLONE, from) == 0;
+    if (cloned || size == 0) {
+        return true;
+    }
+    
+    const std::uint64_t pieceSize = 16ULL << 20;
+    if (copyFileRange(from, to, 0, std::min(size, pieceSize), error)) {
+        size_t pieces = static_cast<size_t>((size + pieceSize - 1) / pieceSize);
+        std::atomic<int> failure{0};
+        runParallel(pieces - 1, jobs, [&](size_t piece) {
+            std::uint64_t start = (piece + 1) * pieceSize;
+            int pieceError = 0;
+            if (!failure && !copyFileRange(from, to, start, std::min(size, start + pieceSize), pieceError)) {
+                failure = pieceError;
+            }
+        });
+        error = failure;
+        return failure == 0;
+    }
+    if (error != EXDEV && error != EINVAL && error != ENOSYS && error != EOPNOTSUPP) {
+        return false;
+    }
+    
+    // Nothing was written by a copy_file_range that is not supported here
+    off_t offset = 0;
+    while (static_cast<std::uint64_t>(offset) < size) {
+        std::uint64_t piece = IoThrottle::copyPiece(size - static_cast<std::uint64_t>(offset));
+        IoThrottle::bytes(piece);
+        ssize_t sent = sendfile(to, from, &offset, static_cast<size_t>(piece));
+        if (sent <= 0) {
+            error = sent == 0 ? EIO : errno;
+            break;
+        }
+    }
+    if (static_cast<std::uint64_t>(offset) == size) {
+        return true;
+    }
+    if (offset != 0 || (error != EINVAL && error != ENOSYS)) {
+        return false;
+    }
+    
+    std::vector<char> buffer(1 << 20);
+    for (std::uint64_t done = 0; done < size;) {
+        std::uint64_t piece = IoThrottle::copyPiece(std::min<std::uint64_t>(size - done, buffer.size()));
+        IoThrottle::bytes(piece);
+        ssize_t got = pread(from, buffer.data(), static_cast<size_t>(piece), static_cast<off_t>(done));
+        if (got <= 0 || pwrite(to, buffer.data(), got, static_cast<off_t>(done)) != got) {
+            error = got == 0 ? EIO : errno;
+            return false;
+        }
+        done += got;
+    }
+    return true;
+}
+#endif
+
+// Moves a file to another file system, for when a rename fails with EXDEV.
+// The data goes to a hidden temporary file next to `to`, which is flushed,
+// checked against the source and only then renamed into place without
+// replacing anything; the source is unlinked last. A crash therefore never
+// leaves a half-written file under the target name nor loses the source.
+// The temporary file is created exclusively under a unique name, so an
+// existing file or symlink of that name is never written through.
+bool moveAcrossDevices(const fs::path& from, const fs::path& to, int jobs, std::error_code& ec) {
+    ec.clear();
+    std::string partBase = (to.parent_path() / ("." + to.filename().string() + ".fileorganizer_part")).string();
+    std::string created;
+#ifdef __linux__
+    int source = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source < 0) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+    struct stat info;
+    int target = -1;
+    if (fstat(source, &info) != 0 ||
+        (target = createUniqueFile(partBase, static_cast<int>(info.st_mode & 07777), created)) < 0) {
+        ec = std::error_code(errno ? errno : EEXIST, std::generic_category());
+        close(source);
+        return false;
+    }
+    fs::path temporary = created;
+    
+    bool cloned = false;
+    int error = 0;
+    bool copied = copyFileData(source, target, static_cast<std::uint64_t>(info.st_size), jobs, cloned, error);
+    if (copied) {
+        // Keep permissions and timestamps, and make the data durable before
+        // the source disappears
+        struct timespec times[2] = {info.st_atim, info.st_mtim};
+        fchmod(target, info.st_mode & 07777);
+        futimens(target, times);
+        struct stat written;
+        if (fsync(target) != 0 || fstat(target, &written) != 0) {
+            copied = false;
+            error = errno;
+        } else if (written.st_size != info.st_size) {
+            copied = false;
+            error = EIO;
+        }
+    }
+    close(target);
+    close(source);
+    std::uint64_t sourceHash = 0;
+    std::uint64_t copyHash = 1;
+    if (copied && !cloned && (!DuplicateFinder::contentHash(from, sourceHash) ||
+                              !DuplicateFinder::contentHash(temporary, copyHash) || sourceHash != copyHash)) {
+        copied = false;
+        error = EIO;
+    }
+    if (!copied) {
+        std::error_code ignored;
+        fs::remove(temporary, ignored);
+        ec = std::error_code(error, std::generic_category());
+        return false;
+    }
+#else
+    (void)jobs;
+    int target = createUniqueFile(partBase, 0666, created);
+    if (target < 0) {
+        ec = std::error_code(errno ? errno : EEXIST, std::generic_category());
+        return false;
+    }
+    fs::path temporary = created;
+    IoThrottle::bytes(fs::file_size(from, ec));
+    std::ifstream source(from, std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    bool copied = static_cast<bool>(source);
+    while (copied && source) {
+        source.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        copied = !source.bad() && writeAll(target, buffer.data(), static_cast<size_t>(source.gcount()));
+    }
+    copied = closeFile(target) && copied;
+    if (!copied || fs::file_size(temporary, ec) != fs::file_size(from, ec)) {
+        std::error_code ignored;
+        fs::remove(temporary, ignored);
+        ec = ec ? ec : std::make_error_code(std::errc::io_error);
+        return false;
+    }
+    fs::permissions(temporary, fs::status(from, ec).permissions(), ec);
+    fs::last_write_time(temporary, fs::last_write_time(from, ec), ec);
+#endif
+    
+    if (!renameNoReplace(temporary, to, ec)) {
+        std::error_code ignored;
+        fs::remove(temporary, ignored);
+        return false;
+    }
+    fs::remove(from, ec);
+    if (ec) {
+        // Keep exactly one copy: the source could not be removed, so the copy goes
+        std::error_code ignored;
+        fs::remove(to, ignored);
+        return false;
+    }
+    return true;
+}
+
+// Identity of a directory's contents as far as the scan index is concerned:
+// any entry added, removed or renamed changes the directory's mtime
+struct DirectoryStamp {
+    std::uint64_t inode = 0;
+    std::int64_t seconds = 0;
+    std::uint64_t nanoseconds = 0;
+    bool settled = false;   // Old enough that a later change gets a different stamp
+    
+    bool operator==(const DirectoryStamp& other) const {
+        return inode == other.inode && seconds == other.seconds && nanoseconds == other.nanoseconds;
+    }
+};
+
+bool directoryStamp(const std::string& folderPath, DirectoryStamp& stamp) {
+#ifdef __linux__
+    struct stat info;
+    if (stat(folderPath.c_str(), &info) != 0) {
+        return false;
+    }
+    stamp.inode = info.st_ino;
+    stamp.seconds = info.st_mtim.tv_sec;
+    stamp.nanoseconds = static_cast<std::uint64_t>(info.st_mtim.tv_nsec);
+    stamp.settled = info.st_mtim.tv_sec < static_cast<std::int64_t>(std::time(nullptr)) - 1;
+#else
+    std::error_code ec;
+    auto written = fs::last_write_time(folderPath, ec);
+    if (ec) {
+        return false;
+    }
+    stamp.seconds = written.time_since_epoch().count();
+    stamp.settled = written < fs::file_time_type::clock::now() - std::chrono::seconds(2);
+#endif
+    return true;
+}
+
+// Persistent per-folder scan results, so --list and --organize do not have
+// to stat and classify every file again. The index lives in its own
+// sub-directory: replacing it there leaves the folder's own mtime, which
+// the index is validated against, untouched. The file is memory-mapped and
+// read in place:
+//
+//   header   "FOSCAN02", directory stamp, fingerprint, flags, count, pool offset
+//   records  count x 32 bytes: inode, size, mtime, name offset, name length, category
+//   order    count x u32 record numbers sorted by name, for binary search
+//   pool     the names
+//   crc32    of everything above; an index that does not match is ignored
+//
+// Records keep listing order. The index describes the folder as long as
+// the directory stamp is unchanged; the fingerprint covers everything the
+// categories depend on (rules, --sniff).
+class ScanIndex {
+public:
+    static constexpr const char* directoryName = ".fileorganizer_cache";
+    
+    struct Record {
+        std::string_view name;
+        std::uint64_t inode;
+        std::uint64_t size;
+        std::int64_t modified;
+        Category category;
+    };
+    
+    explicit ScanIndex(const std::string& folderPath)
+        : directory((fs::path(folderPath) / directoryName).string()),
+          path((fs::path(folderPath) / directoryName / "scan").string()) {}
+    
+    ScanIndex(const ScanIndex&) = delete;
+    ScanIndex& operator=(const ScanIndex&) = delete;
+    
+    ~ScanIndex() {
+        unmap();
+    }
+    
+    // Maps the index; false when it is missing, damaged or was built for
+    // other rules/options
+    bool load(std::uint64_t fingerprint) {
+        unmap();
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(headerSize)) {
+            void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = static_cast<const char*>(mapping);
+                size = static_cast<size_t>(info.st_size);
+                mapped = true;
+            }
+        }
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+#endif
+        if (!data || size < headerSize + checksumSize || std::memcmp(data, magic, 8) != 0 ||
+            getU64(data + 32) != fingerprint ||
+            crc32(data, size - checksumSize) != getU32(data + size - checksumSize)) {
+            unmap();
+            return false;
+        }
+        stamp.inode = getU64(data + 8);
+        stamp.seconds = static_cast<std::int64_t>(getU64(data + 16));
+        stamp.nanoseconds = getU64(data + 24);
+        trusted = (getU32(data + 40) & flagTrusted) != 0;
+        count = getU32(data + 44);
+        poolOffset = getU64(data + 48);
+        if (poolOffset > size - checksumSize || poolOffset != headerSize + std::uint64_t(count) * (recordSize + 4)) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+    
+    // True when the index can stand in for reading the directory
+    bool describes(const DirectoryStamp& current) const {
+        return data && trusted && stamp == current;
+    }
+    
+    size_t entries() const {
+        return data ? count : 0;
+    }
+    
+    // Records in listing order; false for a damaged record
+    bool record(size_t index, Record& out) const {
+        const char* at = data + headerSize + index * recordSize;
+        std::uint64_t nameOffset = poolOffset + getU32(at + 24);
+        std::uint32_t nameLength = static_cast<std::uint16_t>(getU32(at + 28) & 0xFFFF);
+        if (nameOffset + nameLength > size - checksumSize) {
+            return false;
+        }
+        out.name = std::string_view(data + nameOffset, nameLength);
+        out.inode = getU64(at);
+        out.size = getU64(at + 8);
+        out.modified = static_cast<std::int64_t>(getU64(at + 16));
+        out.category = static_cast<Category>(getU32(at + 28) >> 16);
+        return true;
+    }
+    
+    // Binary search over the name order
+    bool find(std::string_view name, Record& out) const {
+        if (!data) {
+            return false;
+        }
+        const char* order = data + headerSize + size_t(count) * recordSize;
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            std::uint32_t index = getU32(order + middle * 4);
+            if (index >= count || !record(index, out)) {
+                return false;
+            }
+            if (out.name == name) {
+                return true;
+            }
+            if (out.name < name) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return false;
+    }
+    
+    // Collects a fresh scan and replaces the index file atomically
+    class Builder {
+    public:
+        void add(const std::string& name, std::uint64_t inode, std::uint64_t size, std::int64_t modified,
+                 Category category) {
+            if (name.size() > 0xFFFF) {
+                return;
+            }
+            std::uint32_t nameOffset = static_cast<std::uint32_t>(pool.size());
+            pool += name;
+            putU64(records, inode);
+            putU64(records, size);
+            putU64(records, static_cast<std::uint64_t>(modified));
+            putU32(records, nameOffset);
+            putU32(records, static_cast<std::uint32_t>(name.size()) |
+                            (static_cast<std::uint32_t>(category) << 16));
+            names.push_back({nameOffset, static_cast<std::uint32_t>(name.size())});
+        }
+        
+        // A directory modified in the last second might change again within
+        // the same timestamp, so such a stamp is not trusted for skipping a scan
+        bool write(const ScanIndex& index, const DirectoryStamp& stamp, std::uint64_t fingerprint) const {
+            std::vector<std::uint32_t> order(names.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = static_cast<std::uint32_t>(i);
+            }
+            std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+                return nameOf(a) < nameOf(b);
+            });
+            
+            std::string out = magic;
+            putU64(out, stamp.inode);
+            putU64(out, static_cast<std::uint64_t>(stamp.seconds));
+            putU64(out, stamp.nanoseconds);
+            putU64(out, fingerprint);
+            putU32(out, stamp.settled ? flagTrusted : 0);
+            putU32(out, static_cast<std::uint32_t>(names.size()));
+            putU64(out, headerSize + std::uint64_t(names.size()) * (recordSize + 4));
+            out += records;
+            for (std::uint32_t index : order) {
+                putU32(out, index);
+            }
+            out += pool;
+            putU32(out, crc32(out.data(), out.size()));
+            
+            // Concurrent list requests may rebuild the same index at once
+            std::error_code ec;
+            fs::create_directory(index.directory, ec);
+            return replaceFile(index.path, out);
+        }
+        
+    private:
+        std::string_view nameOf(std::uint32_t index) const {
+            return std::string_view(pool).substr(names[index].first, names[index].second);
+        }
+        
+        std::string records;
+        std::string pool;
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> names;   // Offset and length in pool
+    };
+
+private:
+    static constexpr const char* magic = "FOSCAN02";
+    static const size_t headerSize = 56;
+    static const size_t checksumSize = 4;   // crc32 of everything before it, at the end of the file
+    static const size_t recordSize = 32;
+    static const std::uint32_t flagTrusted = 1;
+    
+    void unmap() {
+#ifdef __linux__
+        if (mapped) {
+            munmap(const_cast<char*>(data), size);
+        }
+#else
+        buffer.clear();
+#endif
+        mapped = false;
+        data = nullptr;
+        size = 0;
+    }
+    
+    std::string directory;
+    std::string path;
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+#ifndef __linux__
+    std::string buffer;
+#endif
+    DirectoryStamp stamp;
+    bool trusted = false;
+    std::uint32_t count = 0;
+    std::uint64_t poolOffset = 0;
+};
+
+// Append-only binary undo journal for one folder.
+//
+// .fileorganizer_journal holds a magic header followed by checksummed
+// records ([type][payload length][crc32][payload]); a session is a
+// contiguous Begin, Moves..., End run of records. The companion
+// .fileorganizer_journal.idx keeps one fixed-size entry per session
+// (id, offset, length, move count, flags), so history only reads the index
+// and a session's moves are read back with a single seek. Deleting a
+// session appends a tombstone record and flips a flag in its index entry
+// instead of rewriting the journal. The index can always be rebuilt from
+// the journal, which is the source of truth.
+class UndoJournal {
+public:
+    struct SessionInfo {
+        std::string sessionId;
+        std::uint64_t offset = 0;      // Offset of the session's Begin record
+        std::uint64_t length = 0;      // Bytes up to and including the End record
+        std::uint64_t moveCount = 0;
+        std::uint32_t flags = 0;
+        size_t indexSlot = 0;
+        
+        bool deleted() const { return flags & flagDeleted; }
+        bool interrupted() const { return flags & flagInterrupted; }
+    };
+    
+    static const std::uint32_t flagDeleted = 1;
+    static const std::uint32_t flagInterrupted = 2;   // Session has no End record (crash or kill)
+    
+    struct Totals {
+        std::uint64_t files = 0;
+        std::uint64_t bytes = 0;
+    };
+    
+    // What one session moved, for --history. Bytes are the files' sizes as
+    // journaled when they moved; only sessions from journals older than that
+    // fall back to the size found at the new path.
+    struct SessionTotals {
+        Totals all;
+        std::map<std::string, Totals> categories;   // By category folder name
+        
+        void add(const SessionTotals& other) {
+            all.files += other.all.files;
+            all.bytes += other.all.bytes;
+            for (const auto& category : other.categories) {
+                categories[category.first].files += category.second.files;
+                categories[category.first].bytes += category.second.bytes;
+            }
+        }
+    };
+    
+    // Streams one session into the journal while it runs (write-ahead mode).
+    // Before a batch of renames its intents are logged; afterwards a commit
+    // record lists which of them completed. Records from all workers are
+    // group-committed: the first thread to find no write in progress writes
+    // (and, depending on the policy, fsyncs) everything pending while the
+    // others wait for that write instead of issuing their own.
+    class SessionWriter {
+    public:
+        SessionWriter(UndoJournal& journal, const std::string& sessionId, FsyncPolicy policy)
+            : journal(journal), sessionId(sessionId), policy(policy) {}
+        
+        SessionWriter(const SessionWriter&) = delete;
+        SessionWriter& operator=(const SessionWriter&) = delete;
+        
+        ~SessionWriter() {
+            if (file) {
+                std::fclose(file);
+            }
+        }
+        
+        bool begin() {
+            bool isNew = !journal.exists() || fs::file_size(journal.journalPath) == 0;
+            file = std::fopen(journal.journalPath.c_str(), "ab");
+            if (!file) {
+                return false;
+            }
+            if (isNew) {
+                std::fwrite(journalMagic.data(), 1, journalMagic.size(), file);
+            }
+            std::fflush(file);
+            std::fseek(file, 0, SEEK_END);
+            sessionOffset = static_cast<std::uint64_t>(std::ftell(file));
+            append(recordBegin, encodeBegin(sessionId), true);
+            return !failed;
+        }
+        
+        // Logs the planned moves of one batch and returns its batch ID. With
+        // the batch policy this returns only once the intents are on disk.
+        std::uint64_t logIntents(const std::vector<FileMove>& intents) {
+            std::string payload;
+            std::uint64_t batchId = nextBatchId++;
+            putU64(payload, batchId);
+            payload += encodeMoves(intents, 0, intents.size());
+            append(recordSizedIntents, payload, policy == FsyncPolicy::batch);
+            return batchId;
+        }
+        
+        // Logs which intents of a batch completed. An entry carries a new
+        // target path when the move had to pick a different name.
+        void logCommits(std::uint64_t batchId, const std::vector<std::pair<std::uint32_t, std::string>>& commits) {
+            std::string payload;
+            putU64(payload, batchId);
+            putU32(payload, static_cast<std::uint32_t>(commits.size()));
+            for (const auto& commit : commits) {
+                putU32(payload, commit.first);
+                putString(payload, commit.second);
+            }
+            append(recordCommits, payload, false);
+        }
+        
+        // Logs what --dedupe did after the batch's moves completed
+        void logDuplicates(const std::vector<DuplicateAction>& duplicates) {
+            if (!duplicates.empty()) {
+                append(recordDuplicates, encodeDuplicates(duplicates), false);
+            }
+        }
+        
+        // Writes the End record and the session's index entry
+        bool finish(std::uint64_t moveCount) {
+            std::string payload;
+            putU64(payload, moveCount);
+            append(recordEnd, payload, true);
+            if (policy != FsyncPolicy::never && !syncFile(file)) {
+                failed = true;
+            }
+            std::fseek(file, 0, SEEK_END);
+            std::uint64_t endOffset = static_cast<std::uint64_t>(std::ftell(file));
+            std::fclose(file);
+            file = nullptr;
+            if (failed) {
+                return false;
+            }
+            
+            SessionInfo info;
+            info.sessionId = sessionId;
+            info.offset = sessionOffset;
+            info.length = endOffset - sessionOffset;
+            info.moveCount = moveCount;
+            return journal.appendIndexEntry(info);
+        }
+        
+    private:
+        // Queues a record; `durable` waits until it has been written out
+        void append(std::uint32_t type, const std::string& payload, bool durable) {
+            std::unique_lock<std::mutex> lock(mutex);
+            appendRecord(pending, type, payload);
+            std::uint64_t ticket = ++queuedTicket;
+            
+            if (!durable) {
+                // Keep memory flat even when nothing forces a write
+                if (pending.size() >= flushThreshold && !flushing) {
+                    flushLocked(lock);
+                }
+                return;
+            }
+            while (writtenTicket < ticket) {
+                if (!flushing) {
+                    flushLocked(lock);
+                } else {
+                    written.wait(lock);
+                }
+            }
+        }
+        
+        void flushLocked(std::unique_lock<std::mutex>& lock) {
+            flushing = true;
+            std::string data;
+            data.swap(pending);
+            std::uint64_t upTo = queuedTicket;
+            
+            lock.unlock();
+            RunStats::Timer timer(RunStats::phaseJournal);
+            RunStats::count(RunStats::counterJournalBytes, data.size());
+            bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+            ok = ok && (policy == FsyncPolicy::batch ? syncFile(file) : std::fflush(file) == 0);
+            lock.lock();
+            
+            failed = failed || !ok;
+            writtenTicket = upTo;
+            flushing = false;
+            written.notify_all();
+        }
+        
+        static const size_t flushThreshold = 1 << 20;
+        
+        UndoJournal& journal;
+        std::string sessionId;
+        FsyncPolicy policy;
+        FILE* file = nullptr;
+        std::uint64_t sessionOffset = 0;
+        std::uint64_t nextBatchId = 0;
+        
+        std::mutex mutex;
+        std::condition_variable written;
+        std::string pending;
+        std::uint64_t queuedTicket = 0;
+        std::uint64_t writtenTicket = 0;
+        bool flushing = false;
+        bool failed = false;
+    };
+    
+    explicit UndoJournal(const std::string& folderPath)
+        : journalPath(folderPath + "/" + journalFileName),
+          indexPath(folderPath + "/" + journalFileName + ".idx") {}
+    
+    bool exists() const {
+        return fs::exists(journalPath);
+    }
+    
+    // Every session in the journal, oldest first, read from the index alone.
+    // The index is rebuilt from the journal when it is missing or stale.
+    std::vector<SessionInfo> listSessions() {
+        std::vector<SessionInfo> sessions;
+        if (!exists()) {
+            return sessions;
+        }
+        if (!readIndex(sessions)) {
+            sessions = rebuildIndex();
+        }
+        return sessions;
+    }
+    
+    // Appends one complete session and its index entry
+    bool appendSession(const std::string& sessionId, const std::vector<FileMove>& moves,
+                       const std::vector<DuplicateAction>& duplicates = {}) {
+        std::string buffer;
+        appendRecord(buffer, recordBegin, encodeBegin(sessionId));
+        for (size_t start = 0; start < moves.size(); start += movesPerRecord) {
+            size_t end = std::min(moves.size(), start + movesPerRecord);
+            appendRecord(buffer, recordSizedMoves, encodeMoves(moves, start, end));
+        }
+        if (!duplicates.empty()) {
+            appendRecord(buffer, recordDuplicates, encodeDuplicates(duplicates));
+        }
+        std::string endPayload;
+        putU64(endPayload, moves.size());
+        appendRecord(buffer, recordEnd, endPayload);
+        
+        std::uint64_t offset = 0;
+        if (!appendToJournal(buffer, offset)) {
+            return false;
+        }
+        
+        SessionInfo info;
+        info.sessionId = sessionId;
+        info.offset = offset;
+        info.length = buffer.size();
+        info.moveCount = moves.size();
+        return appendIndexEntry(info);
+    }
+    
+    // Reads the moves of one session with a single seek into the journal.
+    // For an interrupted write-ahead session this also recovers moves whose
+    // intent was logged but whose commit never made it, when the file is
+    // found at its target and no longer at its origin. Moves that --dedupe
+    // turned into hard links come back flagged as linked. The moves' paths
+    // live in `paths`.
+    std::vector<FileMove> readSession(const SessionInfo& session, PathPool& paths) {
+        std::vector<FileMove> moves;
+        std::ifstream file(journalPath, std::ios::binary);
+        std::string buffer(session.length, '\0');
+        file.seekg(session.offset);
+        if (!file.read(&buffer[0], buffer.size())) {
+            return moves;
+        }
+        
+        moves.reserve(session.moveCount);
+        std::map<std::uint64_t, std::vector<FileMove>> intents;
+        std::map<std::uint64_t, std::vector<char>> committed;
+        std::unordered_set<std::string> linked;
+        bool ended = false;
+        size_t offset = 0;
+        std::uint32_t type = 0;
+        std::string payload;
+        while (!ended && nextRecord(buffer, offset, type, payload)) {
+            ByteReader reader(payload.data(), payload.size());
+            if (isMovesRecord(type)) {
+                decodeMoves(payload, paths, moves, type == recordSizedMoves);
+            } else if (isIntentsRecord(type)) {
+                std::uint64_t batchId = reader.u64();
+                std::vector<FileMove>& batch = intents[batchId];
+                decodeMoves(std::string_view(payload).substr(8), paths, batch, type == recordSizedIntents);
+                committed[batchId].assign(batch.size(), 0);
+            } else if (type == recordCommits) {
+                std::uint64_t batchId = reader.u64();
+                std::uint32_t count = reader.u32();
+                auto it = intents.find(batchId);
+                for (std::uint32_t i = 0; i < count && reader.ok(); ++i) {
+                    std::uint32_t index = reader.u32();
+                    std::string_view newPath = reader.view();
+                    if (it == intents.end() || index >= it->second.size()) {
+                        continue;
+                    }
+                    FileMove move = it->second[index];
+                    if (!newPath.empty()) {
+                        auto [newFolder, newName] = splitPath(newPath);
+                        move.newFolder = paths.folder(newFolder);
+                        move.newName = paths.store(newName);
+                    }
+                    committed[batchId][index] = 1;
+                    moves.push_back(move);
+                }
+            } else if (type == recordDuplicates) {
+                std::uint32_t count = reader.u32();
+                for (std::uint32_t i = 0; i < count && reader.ok(); ++i) {
+                    std::uint32_t kind = reader.u32();
+                    std::string path = reader.string();
+                    reader.string();
+                    if (kind == DuplicateAction::linked) {
+                        linked.insert(path);
+                    }
+                }
+            } else if (type == recordEnd) {
+                ended = true;
+            }
+        }
+        
+        if (!ended) {
+            for (const auto& batch : intents) {
+                const std::vector<char>& done = committed[batch.first];
+                for (size_t i = 0; i < batch.second.size(); ++i) {
+                    const FileMove& move = batch.second[i];
+                    std::error_code ec;
+                    if (!done[i] && fs::exists(move.newPath(), ec) && !fs::exists(move.originalPath(), ec)) {
+                        moves.push_back(move);
+                    }
+                }
+            }
+        }
+        if (!linked.empty()) {
+            for (auto& move : moves) {
+                move.linked = linked.count(move.newPath()) > 0;
+            }
+        }
+        return moves;
+    }
+    
+    // Totals for each of `sessions` (zero for deleted ones). Sessions never
+    // change once written, so totals are cached per session in the
+    // .fileorganizer_journal.stats sidecar, and only sessions missing from it
+    // are scanned: their journal bytes are read in chunks of whole sessions,
+    // and each move record is decoded and its sizes tallied as a separate
+    // task on `jobs` workers. Nothing is stat'ed unless the journal predates
+    // per-move sizes.
+    std::vector<SessionTotals> sessionTotals(const std::vector<SessionInfo>& sessions, int jobs) {
+        std::vector<SessionTotals> totals(sessions.size());
+        std::map<std::uint64_t, CachedTotals> cache = readTotalsCache();
+        std::vector<size_t> missing;
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            auto cached = cache.find(sessions[i].offset);
+            if (cached != cache.end() && cached->second.sessionId == sessions[i].sessionId &&
+                cached->second.length == sessions[i].length) {
+                totals[i] = std::move(cached->second.totals);
+            } else if (!sessions[i].deleted()) {
+                missing.push_back(i);
+            }
+        }
+        if (missing.empty()) {
+            return totals;
+        }
+        
+        std::ifstream file(journalPath, std::ios::binary);
+        std::mutex mutex;
+        for (size_t first = 0; first < missing.size();) {
+            std::vector<std::string> buffers;
+            size_t chunkBytes = 0;
+            while (first + buffers.size() < missing.size()) {
+                const SessionInfo& session = sessions[missing[first + buffers.size()]];
+                if (!buffers.empty() && chunkBytes + session.length > scanChunkBytes) {
+                    break;
+                }
+                std::string buffer(session.length, '\0');
+                file.clear();
+                file.seekg(session.offset);
+                if (!file.read(&buffer[0], buffer.size())) {
+                    buffer.clear();
+                }
+                chunkBytes += buffer.size();
+                buffers.push_back(std::move(buffer));
+            }
+            
+            // One task per move record. Write-ahead sessions pair intents
+            // with commits, so each of those is read whole by one task.
+            struct ScanTask {
+                size_t session;   // Into buffers
+                size_t offset;
+                bool wholeSession;
+            };
+            std::vector<ScanTask> tasks;
+            for (size_t s = 0; s < buffers.size(); ++s) {
+                const std::string& buffer = buffers[s];
+                size_t firstTask = tasks.size();
+                bool writeAhead = false;
+                for (size_t offset = 0; buffer.size() - offset >= recordHeaderSize;) {
+                    std::uint32_t type = getU32(buffer.data() + offset);
+                    std::uint32_t length = getU32(buffer.data() + offset + 4);
+                    if (buffer.size() - offset - recordHeaderSize < length) {
+                        break;
+                    }
+                    if (isMovesRecord(type)) {
+                        tasks.push_back({s, offset, false});
+                    } else if (isIntentsRecord(type)) {
+                        writeAhead = true;
+                    }
+                    offset += recordHeaderSize + length;
+                }
+                if (writeAhead) {
+                    tasks.resize(firstTask);
+                    tasks.push_back({s, 0, true});
+                }
+            }
+            
+            runParallel(tasks.size(), jobs, [&](size_t t) {
+                const ScanTask& task = tasks[t];
+                const SessionInfo& session = sessions[missing[first + task.session]];
+                PathPool paths;
+                std::vector<FileMove> moves;
+                if (task.wholeSession) {
+                    moves = readSession(session, paths);
+                } else {
+                    size_t offset = task.offset;
+                    std::uint32_t type = 0;
+                    std::string payload;
+                    if (nextRecord(buffers[task.session], offset, type, payload)) {
+                        decodeMoves(payload, paths, moves, type == recordSizedMoves);
+                    }
+                }
+                SessionTotals local;
+                for (const auto& move : moves) {
+                    std::error_code ec;
+                    std::uintmax_t size = move.size;
+                    if (size == FileMove::unknownSize) {
+                        size = fs::file_size(move.newPath(), ec);
+                        RunStats::count(RunStats::counterStat);
+                    }
+                    Totals& category = local.categories[categoryOf(move.newFolder)];
+                    category.files++;
+                    local.all.files++;
+                    if (!ec) {
+                        category.bytes += size;
+                        local.all.bytes += size;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                totals[missing[first + task.session]].add(local);
+            });
+            first += buffers.size();
+        }
+        writeTotalsCache(sessions, totals);
+        return totals;
+    }
+    
+    // Tombstones a session: one appended record plus an in-place flag write
+    bool markDeleted(const SessionInfo& session) {
+        std::string payload;
+        putU64(payload, session.offset);
+        std::string buffer;
+        appendRecord(buffer, recordTombstone, payload);
+        std::uint64_t offset = 0;
+        if (!appendToJournal(buffer, offset)) {
+            return false;
+        }
+        
+        std::fstream index(indexPath, std::ios::binary | std::ios::in | std::ios::out);
+        if (!index) {
+            return false;
+        }
+        std::string flags;
+        putU32(flags, session.flags | flagDeleted);
+        index.seekp(indexHeaderSize + session.indexSlot * indexEntrySize + flagsOffset);
+        index.write(flags.data(), flags.size());
+        
+        // Keep the index's journal size in step with the appended tombstone
+        std::string size;
+        putU64(size, offset + buffer.size());
+        index.seekp(indexMagic.size());
+        index.write(size.data(), size.size());
+        return static_cast<bool>(index);
+    }
+    
+    // One-time conversion of the legacy text log (SESSION:/MOVE:/END_SESSION:
+    // lines). The text log is kept as a .bak file. Returns the number of
+    // sessions converted, or -1 when there was nothing to convert.
+    static int convertTextLog(const std::string& folderPath) {
+        std::string logFile = folderPath + "/" + textLogFileName;
+        if (!fs::exists(logFile)) {
+            return -1;
+        }
+        
+        UndoJournal journal(folderPath);
+        std::ifstream file(logFile);
+        std::string line;
+        std::string currentSession;
+        auto paths = std::make_unique<PathPool>();
+        std::vector<FileMove> moves;
+        int converted = 0;
+        
+        auto flush = [&]() {
+            if (!currentSession.empty() && journal.appendSession(currentSession, moves)) {
+                converted++;
+            }
+            currentSession.clear();
+            moves.clear();
+            paths = std::make_unique<PathPool>();
+        };
+        
+        while (std::getline(file, line)) {
+            if (line.find("SESSION:") == 0) {
+                flush();
+                currentSession = line.substr(8);
+            } else if (line.find("MOVE:") == 0 && !currentSession.empty()) {
+                // Parse move line: MOVE:originalPath|newPath
+                std::string moveInfo = line.substr(5);
+                size_t pos = moveInfo.find('|');
+                if (pos != std::string::npos) {
+                    moves.push_back(paths->record(std::string_view(moveInfo).substr(0, pos),
+                                                  std::string_view(moveInfo).substr(pos + 1)));
+                }
+            } else if (line.find("END_SESSION:") == 0) {
+                flush();
+            }
+        }
+        flush();
+        file.close();
+        
+        std::error_code ec;
+        fs::rename(logFile, logFile + ".bak", ec);
+        return converted;
+    }
+    
+    static constexpr const char* journalFileName = ".fileorganizer_journal";
+    static constexpr const char* textLogFileName = ".fileorganizer_log.txt";
+
+private:
+    enum RecordType : std::uint32_t {
+        recordBegin = 1,
+        recordMoves = 2,
+        recordEnd = 3,
+        recordTombstone = 4,
+        recordIntents = 5,     // Write-ahead: batch ID + planned moves
+        recordCommits = 6,     // Write-ahead: batch ID + completed intent indices
+        recordDuplicates = 7,  // --dedupe: duplicates linked or skipped, with their kept copies
+        recordSizedMoves = 8,  // As recordMoves, with each file's size
+        recordSizedIntents = 9 // As recordIntents, with each file's size
+    };
+    
+    // Readers accept both the original and the sized form of a record
+    static bool isMovesRecord(std::uint32_t type) {
+        return type == recordMoves || type == recordSizedMoves;
+    }
+    
+    static bool isIntentsRecord(std::uint32_t type) {
+        return type == recordIntents || type == recordSizedIntents;
+    }
+    
+    static const size_t recordHeaderSize = 12;   // type, payload length, crc32
+    static const size_t scanChunkBytes = 64 << 20;   // Journal bytes held at once by sessionTotals()
+    static const size_t movesPerRecord = 4096;
+    static const size_t indexEntrySize = 64;     // 32-byte id + 3 x u64 + flags + reserved
+    static const size_t sessionIdBytes = 32;
+    static const size_t flagsOffset = sessionIdBytes + 24;
+    static const size_t indexHeaderSize = 16;    // magic + covered journal size
+    inline static const std::string journalMagic = "FOJRNL01";
+    inline static const std::string indexMagic = "FOINDEX1";
+    inline static const std::string totalsMagic = "FOSTATS1";
+    
+    struct CachedTotals {
+        std::string sessionId;
+        std::uint64_t length = 0;
+        SessionTotals totals;
+    };
+    
+    // The category folder a move went into, above any date layout levels
+    static std::string categoryOf(std::string_view folder) {
+        auto split = splitPath(folder);
+        while (isDateLevel(split.second) && !split.first.empty()) {
+            split = splitPath(split.first);
+        }
+        return std::string(split.second);
+    }
+    
+    // Sidecar entries: session offset, length and ID, then the totals and
+    // their per-category split. A missing or foreign file reads as empty.
+    std::map<std::uint64_t, CachedTotals> readTotalsCache() const {
+        std::map<std::uint64_t, CachedTotals> cache;
+        std::ifstream file(totalsPath(), std::ios::binary);
+        std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (buffer.compare(0, totalsMagic.size(), totalsMagic) != 0) {
+            return cache;
+        }
+        ByteReader reader(buffer.data() + totalsMagic.size(), buffer.size() - totalsMagic.size());
+        while (!reader.atEnd()) {
+            std::uint64_t offset = reader.u64();
+            CachedTotals entry;
+            entry.length = reader.u64();
+            entry.sessionId = reader.string();
+            entry.totals.all.files = reader.u64();
+            entry.totals.all.bytes = reader.u64();
+            std::uint32_t categories = reader.u32();
+            for (std::uint32_t i = 0; i < categories && reader.ok(); ++i) {
+                std::string name = reader.string();
+                Totals& category = entry.totals.categories[name];
+                category.files = reader.u64();
+                category.bytes = reader.u64();
+            }
+            if (!reader.ok()) {
+                break;
+            }
+            cache[offset] = std::move(entry);
+        }
+        return cache;
+    }
+    
+    // Rewritten whole through a temporary file, so readers never see half
+    void writeTotalsCache(const std::vector<SessionInfo>& sessions, const std::vector<SessionTotals>& totals) const {
+        std::string buffer = totalsMagic;
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            if (sessions[i].deleted()) {
+                continue;
+            }
+            putU64(buffer, sessions[i].offset);
+            putU64(buffer, sessions[i].length);
+            putString(buffer, sessions[i].sessionId);
+            putU64(buffer, totals[i].all.files);
+            putU64(buffer, totals[i].all.bytes);
+            putU32(buffer, static_cast<std::uint32_t>(totals[i].categories.size()));
+            for (const auto& category : totals[i].categories) {
+                putString(buffer, category.first);
+                putU64(buffer, category.second.files);
+                putU64(buffer, category.second.bytes);
+            }
+        }
+        // Concurrent --history runs (under --serve) each get their own file
+        replaceFile(totalsPath(), buffer);
+    }
+    
+    std::string totalsPath() const {
+        return journalPath + ".stats";
+    }
+    
+    static void appendRecord(std::string& out, std::uint32_t type, const std::string& payload) {
+        putU32(out, type);
+        putU32(out, static_cast<std::uint32_t>(payload.size()));
+        putU32(out, crc32(payload.data(), payload.size()));
+        out += payload;
+    }
+    
+    // Reads the record at `offset`, advancing past it. Stops at the end of
+    // the buffer, at a torn record, or at a checksum mismatch.
+    static bool nextRecord(const std::string& buffer, size_t& offset, std::uint32_t& type, std::string& payload) {
+        if (buffer.size() - offset < recordHeaderSize) {
+            return false;
+        }
+        type = getU32(buffer.data() + offset);
+        std::uint32_t length = getU32(buffer.data() + offset + 4);
+        std::uint32_t checksum = getU32(buffer.data() + offset + 8);
+        if (buffer.size() - offset - recordHeaderSize < length) {
+            return false;
+        }
+        payload.assign(buffer, offset + recordHeaderSize, length);
+        if (crc32(payload.data(), payload.size()) != checksum) {
+            return false;
+        }
+        offset += recordHeaderSize + length;
+        return true;
+    }
+    
+    static std::string encodeBegin(const std::string& sessionId) {
+        std::string payload;
+        putString(payload, sessionId);
+        return payload;
+    }
+    
+    static std::string encodeMoves(const std::vector<FileMove>& moves, size_t start, size_t end) {
+        std::string payload;
+        putU32(payload, static_cast<std::uint32_t>(end - start));
+        for (size_t i = start; i < end; ++i) {
+            putPath(payload, moves[i].originalFolder, moves[i].name);
+            putPath(payload, moves[i].newFolder, moves[i].newName);
+            putU64(payload, moves[i].size);
+        }
+        return payload;
+    }
+    
+    static std::string encodeDuplicates(const std::vector<DuplicateAction>& duplicates) {
+        std::string payload;
+        putU32(payload, static_cast<std::uint32_t>(duplicates.size()));
+        for (const auto& duplicate : duplicates) {
+            putU32(payload, duplicate.kind);
+            putString(payload, duplicate.path);
+            putString(payload, duplicate.keptPath);
+        }
+        return payload;
+    }
+    
+    // `sized` records carry each file's size after its paths
+    static void decodeMoves(std::string_view payload, PathPool& paths, std::vector<FileMove>& moves, bool sized) {
+        ByteReader reader(payload.data(), payload.size());
+        std::uint32_t count = reader.u32();
+        for (std::uint32_t i = 0; i < count && reader.ok(); ++i) {
+            std::string_view originalPath = reader.view();
+            std::string_view newPath = reader.view();
+            std::uint64_t size = sized ? reader.u64() : FileMove::unknownSize;
+            if (reader.ok()) {
+                moves.push_back(paths.record(originalPath, newPath));
+                moves.back().size = size;
+            }
+        }
+    }
+    
+    // Appends raw record bytes, writing the file header first for a new
+    // journal; `offset` receives the position the bytes were written at
+    bool appendToJournal(const std::string& bytes, std::uint64_t& offset) {
+        bool isNew = !exists() || fs::file_size(journalPath) == 0;
+        std::ofstream file(journalPath, std::ios::binary | std::ios::app);
+        if (!file) {
+            return false;
+        }
+        if (isNew) {
+            file.write(journalMagic.data(), journalMagic.size());
+        }
+        file.seekp(0, std::ios::end);
+        offset = static_cast<std::uint64_t>(file.tellp());
+        RunStats::Timer timer(RunStats::phaseJournal);
+        RunStats::count(RunStats::counterJournalBytes, bytes.size());
+        file.write(bytes.data(), bytes.size());
+        file.flush();
+        return static_cast<bool>(file);
+    }
+    
+    bool appendIndexEntry(SessionInfo& info) {
+        // A missing or stale index is rebuilt, which also picks up this session
+        std::vector<SessionInfo> sessions;
+        if (!readIndex(sessions, info.offset)) {
+            rebuildIndex();
+            return true;
+        }
+        
+        std::fstream index(indexPath, std::ios::binary | std::ios::in | std::ios::out);
+        if (!index) {
+            return false;
+        }
+        index.seekp(0, std::ios::end);
+        std::string entry = encodeIndexEntry(info);
+        index.write(entry.data(), entry.size());
+        
+        std::string size;
+        putU64(size, info.offset + info.length);
+        index.seekp(indexMagic.size());
+        index.write(size.data(), size.size());
+        return static_cast<bool>(index);
+    }
+    
+    static std::string encodeIndexEntry(const SessionInfo& info) {
+        std::string entry = info.sessionId.substr(0, sessionIdBytes);
+        entry.resize(sessionIdBytes, '\0');
+        putU64(entry, info.offset);
+        putU64(entry, info.length);
+        putU64(entry, info.moveCount);
+        putU32(entry, info.flags);
+        putU32(entry, 0);
+        return entry;
+    }
+    
+    // Loads the index if it matches the journal. `expectedSize` defaults to
+    // the journal's current size; the index records how much of the journal
+    // it covers, so a crash between the two writes is detected as stale.
+    bool readIndex(std::vector<SessionInfo>& sessions, std::uint64_t expectedSize = 0) {
+        std::error_code ec;
+        if (expectedSize == 0) {
+            expectedSize = fs::file_size(journalPath, ec);
+        }
+        std::ifstream index(indexPath, std::ios::binary);
+        std::string header(indexHeaderSize, '\0');
+        if (ec || !index || !index.read(&header[0], header.size()) ||
+            header.compare(0, indexMagic.size(), indexMagic) != 0 ||
+            getU64(header.data() + indexMagic.size()) != expectedSize) {
+            return false;
+        }
+        
+        std::string entry(indexEntrySize, '\0');
+        while (index.read(&entry[0], entry.size())) {
+            SessionInfo info;
+            info.sessionId = std::string(entry.data(), std::find(entry.data(), entry.data() + sessionIdBytes, '\0'));
+            info.offset = getU64(entry.data() + sessionIdBytes);
+            info.length = getU64(entry.data() + sessionIdBytes + 8);
+            info.moveCount = getU64(entry.data() + sessionIdBytes + 16);
+            info.flags = getU32(entry.data() + flagsOffset);
+            info.indexSlot = sessions.size();
+            sessions.push_back(std::move(info));
+        }
+        return true;
+    }
+    
+    // Rebuilds the index with one sequential pass over the journal
+    std::vector<SessionInfo> rebuildIndex() {
+        std::vector<SessionInfo> sessions;
+        std::ifstream file(journalPath, std::ios::binary);
+        std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (buffer.compare(0, journalMagic.size(), journalMagic) != 0) {
+            return sessions;
+        }
+        
+        std::map<std::uint64_t, size_t> sessionsByOffset;
+        size_t offset = journalMagic.size();
+        size_t recordStart = offset;
+        std::uint32_t type = 0;
+        std::string payload;
+        SessionInfo current;
+        bool open = false;
+        
+        // A session cut short by a crash has no End record; it is closed at
+        // the last record that belongs to it and flagged as interrupted
+        auto closeInterrupted = [&](size_t endOffset) {
+            current.length = endOffset - current.offset;
+            current.flags |= flagInterrupted;
+            current.indexSlot = sessions.size();
+            sessionsByOffset[current.offset] = sessions.size();
+            sessions.push_back(current);
+            open = false;
+        };
+        
+        while (nextRecord(buffer, offset, type, payload)) {
+            ByteReader reader(payload.data(), payload.size());
+            if (type == recordBegin) {
+                if (open) {
+                    closeInterrupted(recordStart);
+                }
+                current = SessionInfo();
+                current.sessionId = reader.string();
+                current.offset = recordStart;
+                open = true;
+            } else if (isMovesRecord(type) && open) {
+                current.moveCount += reader.u32();
+            } else if (type == recordCommits && open) {
+                reader.u64();
+                current.moveCount += reader.u32();
+            } else if (type == recordEnd && open) {
+                current.length = offset - current.offset;
+                current.indexSlot = sessions.size();
+                sessionsByOffset[current.offset] = sessions.size();
+                sessions.push_back(current);
+                open = false;
+            } else if (type == recordTombstone) {
+                std::uint64_t sessionOffset = reader.u64();
+                if (open && sessionOffset == current.offset) {
+                    closeInterrupted(recordStart);
+                }
+                auto it = sessionsByOffset.find(sessionOffset);
+                if (it != sessionsByOffset.end()) {
+                    sessions[it->second].flags |= flagDeleted;
+                }
+            }
+            recordStart = offset;
+        }
+        if (open) {
+            closeInterrupted(recordStart);
+        }
+        
+        // Drop a torn record left behind by a crash mid-append
+        if (recordStart < buffer.size()) {
+            std::error_code ec;
+            fs::resize_file(journalPath, recordStart, ec);
+        }
+        
+        std::string index = indexMagic;
+        putU64(index, recordStart);
+        for (const auto& session : sessions) {
+            index += encodeIndexEntry(session);
+        }
+        std::ofstream out(indexPath, std::ios::binary | std::ios::trunc);
+        out.write(index.data(), index.size());
+        return sessions;
+    }
+    
+    std::string journalPath;
+    std::string indexPath;
+};
+
+// Structured events reported alongside the text output, for callers that
+// drive the organizer programmatically (--serve). Progress may be reported
+// from worker threads, always under the organizer's output lock.
+class OrganizerObserver {
+public:
+    virtual ~OrganizerObserver() = default;
+    virtual void onListed(const std::string& /*path*/, const std::string& /*category*/, std::uintmax_t /*size*/) {}
+    virtual void onProgress(size_t /*done*/, size_t /*total*/) {}   // total is 0 while still scanning
+    virtual void onSession(const std::string& /*sessionId*/, size_t /*files*/, bool /*interrupted*/) {}
+    virtual void onFinished(const std::string& /*sessionId*/, size_t /*files*/) {}
+    // Once per file moved or restored, straight from the worker threads
+    virtual void onMoved(const std::string& /*from*/, const std::string& /*to*/) {}
+};
+
+#ifdef __linux__
+// Set by SIGINT/SIGTERM while --watch runs
+volatile std::sig_atomic_t watchStopRequested = 0;
+
+void requestWatchStop(int) {
+    watchStopRequested = 1;
+}
+#endif
+
+class SimpleFileOrganizer {
+private:
+    OrganizerOptions options;
+    std::shared_ptr<const RuleSet> rules = std::make_shared<RuleSet>();   // Also owns the folder names
+    std::ostream* output = &std::cout;
+    bool fileLines = true;   // One text line per listed or restored file; off when records carry them
+    OrganizerObserver* observer = nullptr;
+    bool ioUringActive = false;   // Set per organize run once the kernel probe succeeds
+    UndoJournal::SessionWriter* sessionWriter = nullptr;   // Active in write-ahead mode
+    std::vector<DuplicateAction> duplicates;   // --dedupe actions waiting for saveUndoLog()
+    bool planning = false;   // Set by planFolder(): names are claimed but nothing moves
+    
+    // One file waiting to be moved as part of a batch. Both folders are
+    // interned in the session's PathPool.
+    struct PendingMove {
+        fs::path source;
+        std::string_view sourceFolder;
+        std::string_view name;   // The source's file name, stored for the session
+        std::string_view targetDir;
+        DirectoryNameSet* names = nullptr;
+        FileMove* record = nullptr;
+        std::string_view claimedName{};   // Claimed before the move is attempted
+        std::string_view plannedName{};   // Claimed instead of name when set (--apply-plan)
+        bool moved = false;
+    };
+    
+    static const size_t moveBatchSize = 256;
+    static const size_t sniffBatchSize = 64;
+    
+    // Name sets for the target directories owned by one worker
+    using NameSetMap = std::unordered_map<std::string_view, DirectoryNameSet>;
+    
+    static DirectoryNameSet& namesFor(NameSetMap& nameSets, std::string_view targetDir) {
+        return nameSets.try_emplace(targetDir, targetDir).first->second;
+    }
+
+public:
+    bool setOptions(const OrganizerOptions& newOptions) {
+        options = newOptions;
+        if (options.jobs <= 0) {
+            options.jobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (!options.rulesFile.empty()) {
+            auto loaded = std::make_shared<RuleSet>();
+            std::string error;
+            if (!loaded->load(options.rulesFile, error)) {
+                *output << "Error: invalid rules file: " << error << '\n';
+                return false;
+            }
+            rules = loaded;
+        }
+        return true;
+    }
+    
+    // Rule sets are immutable once loaded, so several organizers can share one
+    void setRules(std::shared_ptr<const RuleSet> ruleSet) {
+        rules = std::move(ruleSet);
+    }
+    
+    std::shared_ptr<const RuleSet> ruleSet() const {
+        return rules;
+    }
+    
+    // Human-readable text goes to `stream`. Without perFileLines, only
+    // headers, summaries, warnings and errors are written there, for when an
+    // observer already streams a record per file.
+    void setOutput(std::ostream& stream, bool perFileLines = true) {
+        output = &stream;
+        fileLines = perFileLines;
+    }
+    
+    void setObserver(OrganizerObserver* newObserver) {
+        observer = newObserver;
+    }
+
+    void listFiles(const std::string& folderPath) {
+        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
+            *output << "Error: Folder does not exist: " << folderPath << '\n';
+            return;
+        }
+
+        *output << "Files in " << folderPath << ":\n";
+        *output << "----------------------------------------\n";
+        
+        if (options.recursive) {
+            listFilesRecursive(folderPath);
+            return;
+        }
+        
+        // Sizes are shown, so every entry is stat'ed; only entries the index
+        // does not know, or that changed since, are classified and sniffed
+        std::error_code ec;
+        scanThroughIndex(folderPath, options.sniff, true, true, [&](const IndexedFile& file) {
+            if (fileLines) {
+                *output << "  " << file.name << " -> " << folderName(file.category) << " (" << formatFileSize(file.size)
+                        << ")\n";
+            }
+            if (observer) {
+                observer->onListed(std::string(file.name), folderName(file.category), file.size);
+            }
+        }, ec);
+        if (ec) {
+            *output << "Error scanning " << folderPath << ": " << ec.message() << '\n';
+        }
+    }
+
+    void organizeFolder(const std::string& folderPath) {
+        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
+            *output << "Error: Folder does not exist: " << folderPath << '\n';
+            return;
+        }
+        if (!options.targetRoot.empty() && !fs::is_directory(options.targetRoot)) {
+            *output << "Error: Target folder does not exist: " << options.targetRoot << '\n';
+            return;
+        }
+
+        *output << "Starting file organization in: " << folderPath << '\n';
+        if (options.recursive && options.dedupe != DedupeMode::off) {
+            *output << "Note: --dedupe only applies to top-level runs and is ignored with --recursive.\n";
+        }
+        
+        runSession(folderPath, [&](PathPool& paths, std::vector<FileMove>& moves, size_t& movedFiles) {
+            return options.recursive ? organizeStreaming(folderPath, paths, moves, movedFiles)
+                                     : organizeTopLevel(folderPath, paths, moves, movedFiles);
+        });
+    }
+    
+    // Works out exactly what organizeFolder() would do, resolved unique
+    // names included, without touching the folder. The plan's paths live in
+    // `paths`. Returns false when there is nothing to plan.
+    bool planFolder(const std::string& folderPath, PathPool& paths, std::vector<FileMove>& plan) {
+        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
+            *output << "Error: Folder does not exist: " << folderPath << '\n';
+            return false;
+        }
+        if (!options.targetRoot.empty() && !fs::is_directory(options.targetRoot)) {
+            *output << "Error: Target folder does not exist: " << options.targetRoot << '\n';
+            return false;
+        }
+        if (options.recursive) {
+            *output << "Error: --plan only covers the top level of a folder; drop --recursive.\n";
+            return false;
+        }
+        
+        *output << "Planning file organization in: " << folderPath << '\n';
+        if (options.dedupe != DedupeMode::off) {
+            *output << "Note: --dedupe is not part of a plan and is ignored.\n";
+        }
+        
+        size_t plannedFiles = 0;
+        planning = true;
+        bool foundFiles = organizeTopLevel(folderPath, paths, plan, plannedFiles);
+        planning = false;
+        if (foundFiles) {
+            *output << "Planned " << plannedFiles << " moves.\n";
+        }
+        return foundFiles && plannedFiles > 0;
+    }
+    
+    // Carries out a plan made by planFolder() for folderPath as one undoable
+    // session. Files keep their planned names unless something has taken a
+    // name since; files no longer there are reported and skipped.
+    void applyPlan(const std::string& folderPath, const std::vector<FileMove>& plan) {
+        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
+            *output << "Error: Folder does not exist: " << folderPath << '\n';
+            return;
+        }
+        
+        *output << "Applying plan to: " << folderPath << '\n';
+        runSession(folderPath, [&](PathPool& paths, std::vector<FileMove>& moves, size_t& movedFiles) {
+            return movePlanned(plan, paths, moves, movedFiles);
+        });
+    }
+    
+    void showUndoHistory(const std::string& folderPath) {
+        UndoJournal journal = openJournal(folderPath);
+        
+        if (!journal.exists()) {
+            *output << "No organization history found for this folder.\n";
+            return;
+        }
+        
+        *output << "Organization history for: " << folderPath << '\n';
+        *output << "----------------------------------------\n";
+        
+        // Counts come from the session index; bytes and categories from the
+        // cached totals, so only sessions new since the last call are scanned
+        std::vector<UndoJournal::SessionInfo> sessions = journal.listSessions();
+        std::vector<UndoJournal::SessionTotals> totals = journal.sessionTotals(sessions, options.jobs);
+        UndoJournal::Totals overall;
+        int shown = 0;
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            const UndoJournal::SessionInfo& session = sessions[i];
+            if (!session.deleted()) {
+                *output << "Session: " << session.sessionId << " (" << session.moveCount << " files moved, "
+                        << formatFileSize(totals[i].all.bytes) << ")";
+                if (session.interrupted()) {
+                    *output << " [interrupted - undo recovers the completed moves]";
+                }
+                *output << '\n';
+                for (const auto& category : totals[i].categories) {
+                    *output << "    " << category.first << ": " << category.second.files << " files, "
+                            << formatFileSize(category.second.bytes) << '\n';
+                }
+                if (observer) {
+                    observer->onSession(session.sessionId, session.moveCount, session.interrupted());
+                }
+                overall.files += session.moveCount;
+                overall.bytes += totals[i].all.bytes;
+                shown++;
+            }
+        }
+        
+        if (shown == 0) {
+            *output << "No sessions found.\n";
+        } else {
+            *output << "----------------------------------------\n";
+            *output << "Total: " << overall.files << " files moved, " << formatFileSize(overall.bytes) << " in " << shown
+                    << (shown == 1 ? " session\n" : " sessions\n");
+        }
+    }
+    
+    void undoOrganization(const std::string& folderPath, const std::string& sessionId = "") {
+        UndoJournal journal = openJournal(folderPath);
+        
+        if (!journal.exists()) {
+            *output << "No undo log found for this folder.\n";
+            return;
+        }
+        
+        // Pick the requested session, or the most recent one still active
+        std::vector<UndoJournal::SessionInfo> sessions = journal.listSessions();
+        const UndoJournal::SessionInfo* target = nullptr;
+        for (auto it = sessions.rbegin(); it != sessions.rend(); ++it) {
+            if (!it->deleted() && (sessionId.empty() || it->sessionId == sessionId)) {
+                target = &*it;
+                break;
+            }
+        }
+        
+        PathPool paths;
+        std::vector<FileMove> movesToUndo;
+        if (target) {
+            movesToUndo = journal.readSession(*target, paths);
+        }
+        
+        if (movesToUndo.empty()) {
+            if (sessionId.empty()) {
+                *output << "No moves found to undo.\n";
+            } else {
+                *output << "No moves found for session: " << sessionId << '\n';
+            }
+            return;
+        }
+        
+        // Sort moves in reverse order (undo most recent first)
+        std::reverse(movesToUndo.begin(), movesToUndo.end());
+        
+        *output << "Undoing " << movesToUndo.size() << " file moves...\n";
+        *output << "----------------------------------------\n";
+        
+        activateIoUring();
+        int undoCount = restoreMoves(movesToUndo);
+        
+        // Clean up empty category folders
+        removeEmptyCategories(folderPath, movesToUndo);
+        
+        // Tombstone the undone session in the journal
+        journal.markDeleted(*target);
+        
+        *output << "----------------------------------------\n";
+        *output << "Undo completed! Restored " << undoCount << " files." << std::endl;
+        if (observer) {
+            observer->onFinished(target->sessionId, undoCount);
+        }
+    }
+
+    void convertUndoLog(const std::string& folderPath) {
+        if (UndoJournal(folderPath).exists()) {
+            *output << "This folder already uses the binary undo journal.\n";
+            return;
+        }
+        int converted = UndoJournal::convertTextLog(folderPath);
+        if (converted < 0) {
+            *output << "No text undo log found for this folder.\n";
+        } else {
+            *output << "Converted " << converted << " sessions to the binary undo journal.\n";
+        }
+    }
+
+    // Organizes files as they arrive (--watch). Whatever is already in the
+    // folder goes first; after that inotify reports each file once its
+    // writer closes it or it is moved in. Events are debounced into batches,
+    // files still open for writing are held back, and the batches of one
+    // rolling window share a single write-ahead journal session.
+    void watchFolder(const std::string& folderPath) {
+#ifndef __linux__
+        (void)folderPath;
+        *output << "Error: --watch needs inotify and is only available on Linux.\n";
+#else
+        if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
+            *output << "Error: Folder does not exist: " << folderPath << '\n';
+            return;
+        }
+        
+        int notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notifyFd < 0 || inotify_add_watch(notifyFd, folderPath.c_str(),
+                                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+            *output << "Error: cannot watch " << folderPath << ": " << std::strerror(errno) << '\n';
+            if (notifyFd >= 0) {
+                close(notifyFd);
+            }
+            return;
+        }
+        
+        struct sigaction action = {};
+        action.sa_handler = requestWatchStop;   // No SA_RESTART, so poll() wakes up
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        watchStopRequested = 0;
+        
+        activateIoUring();
+        UndoJournal journal = openJournal(folderPath);
+        RollingSession session{journal};
+        
+        // The watch is already in place, so nothing can slip in between the
+        // initial scan and the first event
+        std::map<std::string, int> pending;   // Name -> times found still being written
+        queueExistingFiles(folderPath, pending);
+        auto now = WatchClock::now();
+        auto lastEvent = now - watchDebounce;
+        auto firstPending = now;
+        
+        *output << "Watching " << folderPath << " for new files (Ctrl+C to stop)..." << std::endl;
+        std::vector<char> buffer(64 * 1024);
+        bool folderGone = false;
+        while (!watchStopRequested && !folderGone) {
+            // Sleep until the batch is due, or the rolling session expires
+            int timeout = -1;
+            now = WatchClock::now();
+            if (!pending.empty()) {
+                auto due = std::min(lastEvent + watchDebounce, firstPending + watchMaxDelay);
+                timeout = static_cast<int>(std::max<std::int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count()));
+            } else if (session.writer) {
+                timeout = static_cast<int>(std::max<std::int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(session.started + watchRollInterval - now).count()));
+            }
+            
+            pollfd waiter = {notifyFd, POLLIN, 0};
+            int ready = poll(&waiter, 1, timeout);
+            if (ready < 0 && errno != EINTR) {
+                *output << "Error: waiting for file events failed: " << std::strerror(errno) << '\n';
+                break;
+            }
+            
+            ssize_t length;
+            while (ready > 0 && (length = read(notifyFd, buffer.data(), buffer.size())) > 0) {
+                for (char* cursor = buffer.data(); cursor < buffer.data() + length;) {
+                    auto* event = reinterpret_cast<inotify_event*>(cursor);
+                    cursor += sizeof(inotify_event) + event->len;
+                    
+                    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                        folderGone = true;
+                    } else if (event->mask & IN_Q_OVERFLOW) {
+                        // Events were dropped: fall back to a full scan
+                        queueExistingFiles(folderPath, pending);
+                    } else if (event->len > 0 && event->name[0] != '.') {
+                        if (pending.empty()) {
+                            firstPending = WatchClock::now();
+                        }
+                        pending.emplace(event->name, 0);
+                    }
+                    lastEvent = WatchClock::now();
+                }
+            }
+            
+            now = WatchClock::now();
+            bool due = now - lastEvent >= watchDebounce || now - firstPending >= watchMaxDelay ||
+                       pending.size() >= watchMaxBatch;
+            if (!pending.empty() && (due || watchStopRequested || folderGone)) {
+                organizeWatchBatch(folderPath, pending, session);
+                // Whatever is left is still being written; look again later
+                lastEvent = firstPending = WatchClock::now();
+            }
+            if (session.writer && WatchClock::now() - session.started >= watchRollInterval) {
+                session.finish(*output);
+            }
+        }
+        
+        if (folderGone) {
+            *output << "Watched folder was removed or moved, stopping." << std::endl;
+        }
+        session.finish(*output);
+        close(notifyFd);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        *output << "Stopped watching " << folderPath << "." << std::endl;
+#endif
+    }
+
+private:
+#ifdef __linux__
+    using WatchClock = std::chrono::steady_clock;
+    
+    // A batch is organized once the folder has been quiet for watchDebounce,
+    // or at the latest watchMaxDelay after its first event
+    static constexpr std::chrono::milliseconds watchDebounce{500};
+    static constexpr std::chrono::milliseconds watchMaxDelay{5000};
+    static constexpr std::chrono::minutes watchRollInterval{60};
+    static const size_t watchMaxBatch = 4096;
+    static const int watchMaxRetries = 1200;   // About ten minutes of a file held open
+    
+    // The journal session the watcher appends to; a new one is started per
+    // rolling window so each can be undone on its own
+    struct RollingSession {
+        UndoJournal& journal;
+        std::unique_ptr<UndoJournal::SessionWriter> writer{};
+        std::string sessionId{};
+        WatchClock::time_point started{};
+        size_t files = 0;
+        
+        void finish(std::ostream& output) {
+            if (!writer) {
+                return;
+            }
+            if (!writer->finish(files)) {
+                output << "Warning: could not complete undo journal session " << sessionId << '\n';
+            }
+            output << "Session " << sessionId << " closed (" << files << " files moved)." << std::endl;
+            writer.reset();
+            files = 0;
+        }
+    };
+    
+    void queueExistingFiles(const std::string& folderPath, std::map<std::string, int>& pending) {
+        std::error_code ec;
+        scanDirectory(folderPath, [&](const ScannedEntry& entry) {
+            if (entry.isRegularFile && isValidFile(entry.path, folderPath)) {
+                pending.emplace(entry.name, 0);
+            }
+        }, ec);
+    }
+    
+    // Moves the pending files that are complete. Files that vanished are
+    // dropped; files still open for writing stay pending for the next round.
+    void organizeWatchBatch(const std::string& folderPath, std::map<std::string, int>& pending,
+                            RollingSession& session) {
+        int directoryFd = open(folderPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd < 0) {
+            return;
+        }
+        
+        PathPool paths;
+        CollectedFiles files;
+        files.folder = paths.folder(folderPath);
+        for (auto it = pending.begin(); it != pending.end();) {
+            ScannedEntry entry;
+            entry.path = fs::path(folderPath) / it->first;
+            entry.name = it->first;
+            entry.directoryFd = directoryFd;
+            
+            struct stat info;
+            bool regular = fstatat(directoryFd, entry.name.c_str(), &info, 0) == 0 && S_ISREG(info.st_mode);
+            if (!regular || !isValidFile(entry.path, folderPath) || isPartialDownload(entry.name)) {
+                it = pending.erase(it);
+                continue;
+            }
+            if (isBeingWritten(directoryFd, entry.name, info)) {
+                // Its writer's close brings it back, but give up eventually
+                it = ++it->second >= watchMaxRetries ? pending.erase(it) : std::next(it);
+                continue;
+            }
+            collect(entry, paths, files);
+            it = pending.erase(it);
+        }
+        close(directoryFd);
+        if (files.names.empty()) {
+            return;
+        }
+        
+        if (!session.writer) {
+            session.sessionId = getCurrentTimestamp();
+            session.writer = std::make_unique<UndoJournal::SessionWriter>(session.journal, session.sessionId,
+                                                                          options.fsyncPolicy);
+            session.started = WatchClock::now();
+            if (!session.writer->begin()) {
+                *output << "Error: could not open undo journal in " << folderPath << '\n';
+                session.writer.reset();
+                return;
+            }
+            *output << "Session " << session.sessionId << " started." << std::endl;
+        }
+        
+        std::vector<FileMove> moves;
+        size_t movedFiles = 0;
+        sessionWriter = session.writer.get();
+        moveCollected(folderPath, files, paths, moves, movedFiles);
+        sessionWriter = nullptr;
+        session.files += movedFiles;
+        *output << "Organized " << movedFiles << " new files (session " << session.sessionId << ")." << std::endl;
+        if (observer) {
+            observer->onFinished(session.sessionId, movedFiles);
+        }
+    }
+    
+    // Temporary names browsers and download tools rename once complete
+    static bool isPartialDownload(const std::string& name) {
+        static const char* const partialExtensions[] = {"part", "partial", "crdownload", "download", "tmp"};
+        std::string extension(extensionOf(name));
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return std::find(std::begin(partialExtensions), std::end(partialExtensions), extension) !=
+               std::end(partialExtensions);
+    }
+    
+    // A read lease is only granted while nobody has the file open for
+    // writing. Where leases are not available (not the owner, network file
+    // systems) a file modified within the debounce window counts as busy.
+    static bool isBeingWritten(int directoryFd, const std::string& name, const struct stat& info) {
+        int fd = openat(directoryFd, name.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd >= 0) {
+            int leased = fcntl(fd, F_SETLEASE, F_RDLCK);
+            int error = errno;
+            if (leased == 0) {
+                fcntl(fd, F_SETLEASE, F_UNLCK);
+            }
+            close(fd);
+            if (leased == 0 || error == EAGAIN) {
+                return leased != 0;
+            }
+        }
+        auto age = std::chrono::system_clock::now() - std::chrono::system_clock::from_time_t(info.st_mtime);
+        return age < watchDebounce;
+    }
+#endif
+    
+    // Streams the whole tree without collecting entries first, printing
+    // paths relative to folderPath so nested files can be told apart
+    void listFilesRecursive(const std::string& folderPath) {
+        std::error_code ec;
+        walkDirectoryTree(folderPath, [&](const ScannedEntry& entry, int depth) {
+            // Skip the same folders organizeStreaming() leaves untouched
+            return entry.name[0] != '.' && !(depth == 0 && isCategoryFolder(entry.name));
+        }, [&](const ScannedEntry& entry, int) {
+            if (!entry.isRegularFile) {
+                return;
+            }
+            
+            bool ruled = false;
+            Category category = classify(entry, ruled);
+            if (options.sniff && !ruled) {
+                Category sniffed = ContentSniffer::classifyFile(entry.path, category);
+                category = sniffed == Category::Others ? category : sniffed;
+            }
+            std::error_code sizeError;
+            auto fileSize = entry.fileSize(sizeError);
+            
+            std::string relativePath = entry.path.lexically_relative(folderPath).generic_string();
+            if (fileLines) {
+                *output << "  " << relativePath << " -> " << folderName(category) << " (" << formatFileSize(fileSize)
+                        << ")\n";
+            }
+            if (observer) {
+                observer->onListed(relativePath, folderName(category), fileSize);
+            }
+        }, ec);
+        if (ec) {
+            *output << "Error scanning " << folderPath << ": " << ec.message() << '\n';
+        }
+    }
+    
+    // Runs `organize` as one undo session of folderPath: organize(paths,
+    // moves, movedFiles) moves the files and returns false when there was
+    // nothing to move. The session is journaled as it goes in write-ahead
+    // mode, and saved afterwards otherwise.
+    template <typename Organize>
+    void runSession(const std::string& folderPath, Organize organize) {
+        // Create session ID for this organization session
+        std::string sessionId = getCurrentTimestamp();
+        *output << "Session ID: " << sessionId << '\n';
+        
+        activateIoUring();
+        
+        // In write-ahead mode undo records go to the journal as files move
+        UndoJournal journal = openJournal(folderPath);
+        std::unique_ptr<UndoJournal::SessionWriter> writer;
+        if (options.writeAhead) {
+            writer = std::make_unique<UndoJournal::SessionWriter>(journal, sessionId, options.fsyncPolicy);
+            if (!writer->begin()) {
+                *output << "Error: could not open undo journal in " << folderPath << '\n';
+                return;
+            }
+            sessionWriter = writer.get();
+        }
+        
+        PathPool paths;
+        std::vector<FileMove> moves;
+        size_t movedFiles = 0;
+        bool foundFiles = organize(paths, moves, movedFiles);
+        sessionWriter = nullptr;
+        
+        if (writer) {
+            // Close the session even when nothing moved, so it is not
+            // mistaken for an interrupted run
+            if (!writer->finish(movedFiles)) {
+                *output << "Warning: could not complete undo journal in " << folderPath << '\n';
+            }
+        }
+        if (!foundFiles) {
+            return;
+        }
+        
+        if (!writer) {
+            // Save move log for undo functionality (single write operation)
+            saveUndoLog(folderPath, moves, sessionId);
+        }
+        
+        *output << "File organization completed! Processed " << movedFiles << " files.\n";
+        *output << "To undo: --undo \"" << folderPath << "\" " << sessionId << std::endl;
+        if (observer) {
+            observer->onFinished(sessionId, movedFiles);
+        }
+    }
+    
+    // Moves the files of a plan. Every target folder is created up front,
+    // then each one is a shard of its own, as in moveCollected().
+    bool movePlanned(const std::vector<FileMove>& plan, PathPool& paths, std::vector<FileMove>& moves,
+                     size_t& movedFiles) {
+        if (plan.empty()) {
+            *output << "No moves in plan.\n";
+            return false;
+        }
+        
+        std::map<std::string_view, std::vector<size_t>> shardsByTarget;
+        for (size_t i = 0; i < plan.size(); ++i) {
+            shardsByTarget[plan[i].newFolder].push_back(i);
+        }
+        std::vector<const std::vector<size_t>*> shards;
+        std::vector<std::string_view> shardTargets;
+        {
+            RunStats::Timer timer(RunStats::phaseMkdir);
+            for (const auto& shard : shardsByTarget) {
+                std::error_code ec;
+                fs::create_directories(fs::path(shard.first), ec);
+                shards.push_back(&shard.second);
+                shardTargets.push_back(paths.folder(shard.first));
+            }
+        }
+        
+        std::vector<FileMove> slots(plan.size());
+        std::vector<char> moved(plan.size(), 0);
+        // The plan outlives the session, so its views are recorded as they are
+        int processedFiles = moveShards(shards, shardTargets, static_cast<int>(plan.size()), moved, paths,
+            [&](size_t index, std::string_view targetDir, DirectoryNameSet& names) {
+                const FileMove& planned = plan[index];
+                PendingMove pending{planned.originalPath(), planned.originalFolder, planned.name, targetDir, &names,
+                                    &slots[index]};
+                pending.plannedName = planned.newName;
+                return pending;
+            });
+        
+        // Files that went missing, and names taken since the plan was made
+        size_t missing = 0;
+        size_t renamed = 0;
+        for (size_t i = 0; i < plan.size(); ++i) {
+            if (!moved[i]) {
+                missing++;
+            } else if (slots[i].newName != plan[i].newName) {
+                renamed++;
+            }
+        }
+        if (missing > 0) {
+            *output << "Note: " << missing << " planned files could not be moved.\n";
+        }
+        if (renamed > 0) {
+            *output << "Note: " << renamed << " files got a different name than planned, as theirs was taken.\n";
+        }
+        
+        movedFiles = processedFiles;
+        if (!sessionWriter) {
+            size_t kept = 0;
+            for (size_t i = 0; i < slots.size(); ++i) {
+                if (moved[i]) {
+                    slots[kept++] = slots[i];
+                }
+            }
+            slots.resize(kept);
+            moves = std::move(slots);
+        }
+        return true;
+    }
+    
+    // Scans only the top level of folderPath, then moves the collected files
+    bool organizeTopLevel(const std::string& folderPath, PathPool& paths, std::vector<FileMove>& moves,
+                          size_t& movedFiles) {
+        CollectedFiles files;
+        files.folder = paths.folder(folderPath);
+        // Nothing is taken out of a folder that is itself a category folder
+        bool organizable = isValidFile(fs::path(folderPath) / "file", folderPath);
+        
+        // First pass: collect all valid files and their categories. Entries
+        // the scan index already knows keep their recorded category.
+        *output << "Scanning files..." << std::flush;
+        std::error_code ec;
+        scanThroughIndex(folderPath, false, false, false, [&](const IndexedFile& file) {
+            if (organizable && isValidName(file.name)) {
+                files.names.push_back(paths.store(file.name));
+                files.categories.push_back(file.category);
+                files.settled.push_back(file.indexed || file.ruled);
+            }
+        }, ec);
+        if (ec) {
+            *output << "\nError scanning " << folderPath << ": " << ec.message() << '\n';
+            return false;
+        }
+        
+        if (files.names.empty()) {
+            *output << "\nNo files to organize.\n";
+            return false;
+        }
+        
+        *output << " Found " << files.names.size() << " files to organize.\n";
+        moveCollected(folderPath, files, paths, moves, movedFiles);
+        if (planning) {
+            return true;
+        }
+        
+        // Record what is left, so the next run can skip the scan
+        scanThroughIndex(folderPath, options.sniff, true, false, [](const IndexedFile&) {}, ec);
+        return true;
+    }
+    
+    // One top-level file as seen through the scan index
+    struct IndexedFile {
+        std::string_view name;
+        Category category;
+        std::uintmax_t size;
+        bool indexed;   // Taken from the index, including any sniffed category
+        bool ruled;     // Matched a user rule
+    };
+    
+    std::uint64_t indexFingerprint() const {
+        return rules->fingerprint() ^ (options.sniff ? 0x9e3779b97f4a7c15ULL : 0);
+    }
+    
+    // Visits the regular files at the top of folderPath. When the folder is
+    // unchanged since the index was written the directory is not read at
+    // all; otherwise entries whose name and inode match the index reuse its
+    // size and category, and only the rest are stat'ed, classified and (with
+    // sniffNew) sniffed. update rewrites the index from this scan, which
+    // needs every new entry's size and mtime.
+    //
+    // Rewriting a file in place leaves its folder's stamp and its inode as
+    // they were, so recorded sizes (and categories that rules or sniffing
+    // derived from the content) can be stale. When exactSizes is set, or
+    // the category depends on more than the name, every entry is stat'ed
+    // and only reuses its record if size and mtime still match.
+    template <typename Visit>
+    void scanThroughIndex(const std::string& folderPath, bool sniffNew, bool update, bool exactSizes, Visit visit,
+                          std::error_code& ec) {
+        ScanIndex index(folderPath);
+        bool indexed = index.load(indexFingerprint());
+        DirectoryStamp stamp;
+        bool stamped = directoryStamp(folderPath, stamp);
+        ScanIndex::Record record;
+        bool verify = exactSizes || options.sniff || rules->needsStatus();
+        
+        if (!verify && stamped && index.describes(stamp)) {
+            for (size_t i = 0; i < index.entries(); ++i) {
+                if (index.record(i, record)) {
+                    visit(IndexedFile{record.name, record.category, record.size, true, false});
+                }
+            }
+            return;
+        }
+        
+        ScanIndex::Builder builder;
+        scanDirectory(folderPath, [&](const ScannedEntry& entry) {
+            if (!entry.isRegularFile) {
+                return;
+            }
+            
+            FileStatus status;
+            bool haveStatus = false;
+            auto lookupStatus = [&](std::error_code& statusError) {
+                if (!haveStatus) {
+                    status = entry.status(statusError);
+                    haveStatus = true;
+                }
+                return status;
+            };
+            if (indexed && entry.inode != 0 && index.find(entry.name, record) && record.inode == entry.inode) {
+                bool current = !verify;
+                if (verify) {
+                    std::error_code statusError;
+                    lookupStatus(statusError);
+                    current = !statusError && status.size == record.size && status.modified == record.modified;
+                }
+                if (current) {
+                    if (update) {
+                        builder.add(entry.name, record.inode, record.size, record.modified, record.category);
+                    }
+                    visit(IndexedFile{entry.name, record.category, record.size, true, false});
+                    return;
+                }
+            }
+
+            bool ruled = false;
+            Category category = classify(entry.name, lookupStatus, ruled);
+            if (sniffNew && !ruled) {
+                Category sniffed = ContentSniffer::classifyFile(entry.path, category);
+                category = sniffed == Category::Others ? category : sniffed;
+            }
+            if (update) {
+                std::error_code statusError;
+                lookupStatus(statusError);
+                builder.add(entry.name, entry.inode, status.size, status.modified, category);
+            }
+            visit(IndexedFile{entry.name, category, status.size, false, ruled});
+        }, ec);
+        
+        if (update && stamped && !ec) {
+            builder.write(index, stamp, indexFingerprint());
+        }
+    }
+    
+    // Files picked up at the top of one folder by a scan or by the watcher,
+    // with their categories. The names live in the session's PathPool, so
+    // move records refer to them as they are; full paths are only built
+    // where a system call needs one.
+    struct CollectedFiles {
+        std::string_view folder;   // Interned
+        std::vector<std::string_view> names;
+        std::vector<Category> categories;
+        std::vector<char> settled;   // Matched a user rule or came from the scan index, so sniffing must not override it
+        
+        fs::path path(size_t file) const {
+            return fs::path(joinPath(folder, names[file]));
+        }
+    };
+    
+    void collect(const ScannedEntry& entry, PathPool& paths, CollectedFiles& files) const {
+        bool matchedRule = false;
+        files.names.push_back(paths.store(entry.name));
+        files.categories.push_back(classify(entry, matchedRule));
+        files.settled.push_back(matchedRule);
+    }
+    
+    // Moves collected files into their category folders, sharded by target
+    // directory over the worker pool. The moves' paths are kept in `paths`.
+    void moveCollected(const std::string& folderPath, CollectedFiles& files, PathPool& paths,
+                       std::vector<FileMove>& moves, size_t& movedFiles) {
+        const std::vector<std::string_view>& filesToProcess = files.names;
+        std::vector<Category>& fileCategories = files.categories;
+        std::set<std::string> neededCategories;
+        
+        if (options.sniff) {
+            applySniffedCategories(files, fileCategories);
+        }
+        
+        // keptCopy[i] is set when file i is identical to a file already in a
+        // category folder (kept.existing) or to an earlier collected file
+        DuplicateMatches kept;
+        if (options.dedupe != DedupeMode::off && !planning) {
+            kept = findDuplicates(folderPath, files);
+        }
+        bool skipDuplicates = options.dedupe == DedupeMode::skip;
+        std::vector<std::uint32_t> months = captureMonths(files, fileCategories);
+        
+        int totalFiles = 0;
+        for (size_t i = 0; i < filesToProcess.size(); ++i) {
+            if (!(skipDuplicates && kept.isDuplicate(i))) {
+                addTargetFolder(neededCategories, fileCategories[i], months[i]);
+                ++totalFiles;
+            }
+        }
+        
+        // Create only the category (and date) folders that are actually needed
+        if (!planning) {
+            createCategoryFolders(categoryRoot(folderPath), neededCategories, openRing().get());
+        }
+        
+        // Shard the work by target directory: each shard is owned by a single
+        // worker, so name conflict resolution inside a directory never races
+        std::map<std::pair<Category, std::uint32_t>, std::vector<size_t>> shardsByTarget;
+        for (size_t i = 0; i < filesToProcess.size(); ++i) {
+            if (!(skipDuplicates && kept.isDuplicate(i))) {
+                shardsByTarget[{fileCategories[i], months[i]}].push_back(i);
+            }
+        }
+        std::vector<const std::vector<size_t>*> shards;
+        std::vector<std::string_view> shardTargets;
+        for (const auto& shard : shardsByTarget) {
+            shards.push_back(&shard.second);
+            shardTargets.push_back(
+                paths.folder(categoryRoot(folderPath) + "/" + targetFolder(shard.first.first, shard.first.second)));
+        }
+        
+        // Moves land in scan order slots so the undo session stays ordered
+        std::vector<FileMove> slots(filesToProcess.size());
+        std::vector<char> moved(filesToProcess.size(), 0);
+        int processedFiles = moveShards(shards, shardTargets, totalFiles, moved, paths,
+            [&](size_t index, std::string_view targetDir, DirectoryNameSet& names) {
+                return PendingMove{files.path(index), files.folder, filesToProcess[index], targetDir, &names,
+                                   &slots[index]};
+            });
+        
+        if (options.dedupe != DedupeMode::off && !planning) {
+            applyDuplicates(files, kept, slots, moved);
+        }
+        
+        // Close the gaps left by files that did not move; the slots, already
+        // in scan order, become the session
+        movedFiles = processedFiles;
+        if (!sessionWriter) {
+            size_t kept = 0;
+            for (size_t i = 0; i < slots.size(); ++i) {
+                if (moved[i]) {
+                    slots[kept++] = slots[i];
+                }
+            }
+            slots.resize(kept);
+            moves = std::move(slots);
+        }
+    }
+    
+    // Moves files shard by shard, each shard being the files bound for one
+    // target directory and owned by a single worker, so name conflict
+    // resolution inside a directory never races. pendingFor(index,
+    // targetDir, names) describes file `index`; moved[index] is set for
+    // every file that moved. Returns how many did.
+    template <typename PendingFor>
+    int moveShards(const std::vector<const std::vector<size_t>*>& shards,
+                   const std::vector<std::string_view>& shardTargets, int totalFiles, std::vector<char>& moved,
+                   PathPool& paths, PendingFor pendingFor) {
+        *output << "Processing files";
+        if (options.jobs > 1) {
+            *output << " (" << std::min<size_t>(options.jobs, shards.size()) << " workers)";
+        }
+        *output << ":\n";
+        
+        std::atomic<int> processedFiles{0};
+        std::mutex outputMutex;
+        int lastProgress = -1;
+        
+        runParallel(shards.size(), options.jobs, [&](size_t shardIndex) {
+            std::unique_ptr<IoUring> ring = openRing();
+            PathArena arena;
+            const std::vector<size_t>& shard = *shards[shardIndex];
+            std::string_view targetDir = shardTargets[shardIndex];
+            DirectoryNameSet names(targetDir);
+            
+            size_t batchSize = IoThrottle::batchSize(moveBatchSize);
+            for (size_t start = 0; start < shard.size(); start += batchSize) {
+                size_t end = std::min(shard.size(), start + batchSize);
+                std::vector<PendingMove> batch;
+                batch.reserve(end - start);
+                for (size_t i = start; i < end; ++i) {
+                    batch.push_back(pendingFor(shard[i], targetDir, names));
+                }
+                moveBatch(batch, arena, outputMutex, ring.get());
+                
+                for (size_t i = start; i < end; ++i) {
+                    if (!batch[i - start].moved) {
+                        continue;
+                    }
+                    moved[shard[i]] = 1;
+                    int done = ++processedFiles;
+                    
+                    // Show progress only at 10% intervals or every 100 files
+                    int percentage = (done * 100) / totalFiles;
+                    if (percentage % 10 == 0 || done % 100 == 0 || done == totalFiles) {
+                        std::lock_guard<std::mutex> lock(outputMutex);
+                        if (percentage != lastProgress) {
+                            *output << "Progress: " << done << "/" << totalFiles << " (" << percentage << "%)" << std::endl;
+                            lastProgress = percentage;
+                            if (observer) {
+                                observer->onProgress(done, totalFiles);
+                            }
+                        }
+                    }
+                }
+            }
+            paths.adopt(std::move(arena));
+        });
+        return processedFiles;
+    }
+    
+    // Walks the whole tree under folderPath and moves files while the scan is
+    // still running. The scanner feeds one bounded queue per worker and every
+    // category is routed to a fixed worker, so memory stays flat and each
+    // target directory keeps a single owner for conflict resolution.
+    bool organizeStreaming(const std::string& folderPath, PathPool& paths, std::vector<FileMove>& moves,
+                           size_t& movedFiles) {
+        struct WorkItem {
+            fs::path path;
+            std::string_view folder;   // Interned parent folder
+            std::string_view name;     // Stored in the producer's arena
+            Category category;
+            size_t sequence;
+            bool ruled;   // Matched a user rule, so sniffing must not override it
+        };
+        const size_t queueCapacity = 1024;
+        
+        size_t workerCount = static_cast<size_t>(std::max(options.jobs, 1));
+        std::vector<std::unique_ptr<BoundedQueue<WorkItem>>> queues;
+        for (size_t w = 0; w < workerCount; ++w) {
+            queues.push_back(std::make_unique<BoundedQueue<WorkItem>>(queueCapacity));
+        }
+        
+        std::vector<std::vector<std::pair<size_t, FileMove>>> workerMoves(workerCount);
+        std::atomic<int> processedFiles{0};
+        std::mutex outputMutex;
+        
+        *output << "Scanning and processing files recursively";
+        if (workerCount > 1) {
+            *output << " (" << workerCount << " workers)";
+        }
+        *output << ":\n";
+        
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < workerCount; ++w) {
+            workers.emplace_back([&, w]() {
+                std::unique_ptr<IoUring> ring = openRing();
+                PathArena arena;
+                NameSetMap nameSets;
+                std::map<std::pair<Category, std::uint32_t>, std::string_view> targetDirs;
+                std::vector<WorkItem> items;
+                while (queues[w]->popBatch(items, IoThrottle::batchSize(moveBatchSize))) {
+                    std::vector<FileMove> records(items.size());
+                    std::vector<PendingMove> batch;
+                    batch.reserve(items.size());
+                    for (size_t i = 0; i < items.size(); ++i) {
+                        // This worker owns the category, so it can create it lazily
+                        std::pair<Category, std::uint32_t> key{items[i].category, captureMonth(items[i].category,
+                                                                                               items[i].path)};
+                        auto target = targetDirs.find(key);
+                        if (target == targetDirs.end()) {
+                            std::set<std::string> folders;
+                            addTargetFolder(folders, key.first, key.second);
+                            createCategoryFolders(categoryRoot(folderPath), folders, ring.get());
+                            std::string_view targetDir =
+                                paths.folder(categoryRoot(folderPath) + "/" + targetFolder(key.first, key.second));
+                            target = targetDirs.emplace(key, targetDir).first;
+                        }
+                        DirectoryNameSet& names = namesFor(nameSets, target->second);
+                        batch.push_back({std::move(items[i].path), items[i].folder, items[i].name, target->second, &names,
+                                         &records[i]});
+                    }
+                    moveBatch(batch, arena, outputMutex, ring.get());
+                    
+                    for (size_t i = 0; i < items.size(); ++i) {
+                        if (!batch[i].moved) {
+                            continue;
+                        }
+                        if (!sessionWriter) {
+                            workerMoves[w].emplace_back(items[i].sequence, records[i]);
+                        }
+                        int done = ++processedFiles;
+                        if (done % 100 == 0) {
+                            std::lock_guard<std::mutex> lock(outputMutex);
+                            *output << "Progress: " << done << " files moved" << std::endl;
+                            if (observer) {
+                                observer->onProgress(done, 0);
+                            }
+                        }
+                    }
+                    items.clear();
+                }
+                paths.adopt(std::move(arena));
+            });
+        }
+        
+        // Producer: stream entries straight into the worker queues. With
+        // --sniff, entries are held back in small batches so their headers
+        // can be read together before they are routed.
+        size_t scannedFiles = 0;
+        std::vector<WorkItem> sniffBatch;
+        auto dispatch = [&](WorkItem item) {
+            size_t owner = static_cast<size_t>(item.category) % workerCount;
+            queues[owner]->push(std::move(item));
+        };
+        auto flushSniffBatch = [&]() {
+            std::vector<fs::path> paths;
+            std::vector<Category> byName;
+            for (const auto& item : sniffBatch) {
+                paths.push_back(item.path);
+                byName.push_back(item.category);
+            }
+            std::vector<Category> sniffed = ContentSniffer::classifyFiles(paths, byName);
+            for (size_t i = 0; i < sniffBatch.size(); ++i) {
+                if (sniffed[i] != Category::Others && !sniffBatch[i].ruled) {
+                    sniffBatch[i].category = sniffed[i];
+                }
+                dispatch(std::move(sniffBatch[i]));
+            }
+            sniffBatch.clear();
+        };
+        
+        // A directory's entries arrive together, so its path is interned once
+        PathArena names;
+        std::string_view currentFolder;
+        auto internFolder = [&](const fs::path& path) {
+            const auto& text = pathText(path);
+            std::string_view folder = splitPath(text).first;
+            if (currentFolder.data() == nullptr || folder != currentFolder) {
+                currentFolder = paths.folder(folder);
+            }
+            return currentFolder;
+        };
+        
+        std::error_code ec;
+        walkDirectoryTree(folderPath, [&](const ScannedEntry& entry, int depth) {
+            // Never descend into hidden folders or our own category folders
+            return entry.name[0] != '.' && !(depth == 0 && isCategoryFolder(entry.name));
+        }, [&](const ScannedEntry& entry, int) {
+            if (!entry.isRegularFile || !isValidFile(entry.path, folderPath)) {
+                return;
+            }
+            
+            WorkItem item{entry.path, internFolder(entry.path), names.store(entry.name), Category::Others,
+                          scannedFiles++, false};
+            item.category = classify(entry, item.ruled);
+            if (!options.sniff) {
+                dispatch(std::move(item));
+                return;
+            }
+            sniffBatch.push_back(std::move(item));
+            if (sniffBatch.size() == sniffBatchSize) {
+                flushSniffBatch();
+            }
+        }, ec);
+        flushSniffBatch();
+        if (ec) {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            *output << "Error scanning " << folderPath << ": " << ec.message() << '\n';
+        }
+        
+        for (auto& queue : queues) {
+            queue->close();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        paths.adopt(std::move(names));
+        
+        if (scannedFiles == 0) {
+            *output << "No files to organize.\n";
+            return false;
+        }
+        
+        // Merge the per-worker records back into scan order for the undo log
+        movedFiles = processedFiles;
+        std::vector<std::pair<size_t, FileMove>> ordered;
+        ordered.reserve(processedFiles);
+        for (auto& records : workerMoves) {
+            std::move(records.begin(), records.end(), std::back_inserter(ordered));
+        }
+        std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+        moves.reserve(ordered.size());
+        for (auto& record : ordered) {
+            moves.push_back(std::move(record.second));
+        }
+        return true;
+    }
+    
+    // Probes the kernel once per run when --io-uring was requested
+    void activateIoUring() {
+        ioUringActive = false;
+        if (options.ioUring) {
+            IoUring probe;
+            ioUringActive = probe.init(moveBatchSize);
+            *output << (ioUringActive ? "Using io_uring batched file operations."
+                                        : "io_uring is not available, using standard file operations.") << '\n';
+        }
+    }
+    
+    // Outcome of restoring a single move during undo
+    struct RestoreResult {
+        enum Status { restored, missing, failed } status = failed;
+        std::string error;
+    };
+    
+    // Reverses moves given newest first. Moves that share a path (a file
+    // moved more than once, or a name reused) form a chain that must be
+    // undone in order; every other move is independent. Chains are grouped
+    // by the folder they are restored from and those groups run on the
+    // worker pool, with single moves renamed in batches. Per-file lines are
+    // buffered per worker and written out in large chunks.
+    int restoreMoves(const std::vector<FileMove>& movesToUndo) {
+        // Union-find over moves, joined whenever two moves touch the same path
+        std::vector<size_t> parent(movesToUndo.size());
+        for (size_t i = 0; i < parent.size(); ++i) {
+            parent[i] = i;
+        }
+        auto find = [&](size_t i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        };
+        // Folders are interned, so a path is identified by its folder's
+        // address plus its name, without building the path
+        using PathKey = std::pair<const char*, std::string_view>;
+        struct PathKeyHash {
+            size_t operator()(const PathKey& key) const {
+                return std::hash<const char*>()(key.first) * 31 + std::hash<std::string_view>()(key.second);
+            }
+        };
+        std::unordered_map<PathKey, size_t, PathKeyHash> pathOwner;
+        pathOwner.reserve(movesToUndo.size() * 2);
+        for (size_t i = 0; i < movesToUndo.size(); ++i) {
+            const FileMove& move = movesToUndo[i];
+            for (PathKey path : {PathKey(move.originalFolder.data(), move.name), PathKey(move.newFolder.data(), move.newName)}) {
+                auto inserted = pathOwner.emplace(path, i);
+                if (!inserted.second) {
+                    parent[find(i)] = find(inserted.first->second);
+                }
+            }
+        }
+        
+        // Chains keep undo order; they are sharded by the folder restored from
+        std::unordered_map<size_t, std::vector<size_t>> chains;
+        for (size_t i = 0; i < movesToUndo.size(); ++i) {
+            chains[find(i)].push_back(i);
+        }
+        std::map<std::string_view, std::vector<const std::vector<size_t>*>> shardsByFolder;
+        for (const auto& chain : chains) {
+            shardsByFolder[movesToUndo[chain.second.front()].newFolder].push_back(&chain.second);
+        }
+        std::vector<const std::vector<const std::vector<size_t>*>*> shards;
+        for (const auto& shard : shardsByFolder) {
+            shards.push_back(&shard.second);
+        }
+        
+        std::atomic<int> undoCount{0};
+        std::mutex outputMutex;
+        runParallel(shards.size(), options.jobs, [&](size_t shardIndex) {
+            std::unique_ptr<IoUring> ring = openRing();
+            std::string buffered;
+            size_t reported = 0;
+            std::vector<const FileMove*> batch;
+            
+            auto report = [&](const FileMove& move, const RestoreResult& result) {
+                if (result.status == RestoreResult::restored) {
+                    if (move.linked && !detachLink(move.originalPath())) {
+                        buffered.append("⚠ Restored as a hard link: ").append(move.name) += '\n';
+                    }
+                    undoCount++;
+                    if (fileLines) {
+                        buffered.append("✓ Restored: ").append(move.name) += '\n';
+                    }
+                } else if (result.status == RestoreResult::missing) {
+                    buffered.append("⚠ File not found: ").append(move.newName) += '\n';
+                } else {
+                    buffered.append("❌ Error restoring ").append(move.name).append(": ").append(result.error) += '\n';
+                }
+                // Progress goes out with every 64 KB of text, or every 1024
+                // files when per-file lines are off
+                if (buffered.size() >= 64 * 1024 || ++reported % 1024 == 0) {
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    *output << buffered << std::flush;
+                    buffered.clear();
+                    if (observer) {
+                        observer->onProgress(undoCount, movesToUndo.size());
+                    }
+                }
+            };
+            auto flushBatch = [&]() {
+                std::vector<RestoreResult> results = restoreBatch(batch, ring.get());
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    report(*batch[i], results[i]);
+                }
+                batch.clear();
+            };
+            
+            for (const std::vector<size_t>* chain : *shards[shardIndex]) {
+                if (chain->size() == 1) {
+                    batch.push_back(&movesToUndo[chain->front()]);
+                    if (batch.size() == IoThrottle::batchSize(moveBatchSize)) {
+                        flushBatch();
+                    }
+                    continue;
+                }
+                for (size_t index : *chain) {
+                    IoThrottle::operations(1);
+                    report(movesToUndo[index], restoreMove(movesToUndo[index]));
+                }
+            }
+            flushBatch();
+            
+            std::lock_guard<std::mutex> lock(outputMutex);
+            *output << buffered << std::flush;
+            if (observer) {
+                observer->onProgress(undoCount, movesToUndo.size());
+            }
+        });
+        
+        return undoCount;
+    }
+    
+    // Restores independent moves, submitting them together through the ring
+    // when one is available
+    std::vector<RestoreResult> restoreBatch(const std::vector<const FileMove*>& batch, IoUring* ring) {
+        std::vector<RestoreResult> results(batch.size());
+        IoThrottle::operations(batch.size());
+        if (!ring || !ring->ready() || batch.empty()) {
+            for (size_t i = 0; i < batch.size(); ++i) {
+                results[i] = restoreMove(*batch[i]);
+            }
+            return results;
+        }
+        
+        RunStats::Timer timer(RunStats::phaseMoveBatch);
+        std::vector<int> codes(batch.size(), -EINVAL);
+        PathArena scratch;   // NUL-terminated paths for the ring, dropped with the batch
+        // A ring that fails is torn down; whatever it did not complete is
+        // left at -EINVAL and restored one at a time below
+        for (size_t start = 0; start < batch.size() && ring->ready(); start += ring->size()) {
+            size_t count = std::min<size_t>(ring->size(), batch.size() - start);
+            for (size_t i = start; i < start + count; ++i) {
+                const FileMove& move = *batch[i];
+                ring->queueRename(scratch.join(move.newFolder, move.newName).data(),
+                                  scratch.join(move.originalFolder, move.name).data(), RENAME_NOREPLACE, i);
+            }
+            RunStats::count(RunStats::counterRename, count);
+            ring->submitAndWait([&](std::uint64_t id, int result) { codes[id] = result; });
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (codes[i] == 0) {
+                results[i].status = RestoreResult::restored;
+                if (observer) {
+                    observer->onMoved(batch[i]->newPath(), batch[i]->originalPath());
+                }
+            } else {
+                // Missing files, unsupported flags and errors take the slow path
+                results[i] = restoreMove(*batch[i]);
+            }
+        }
+        return results;
+    }
+    
+    RestoreResult restoreMove(const FileMove& move) {
+        RestoreResult result;
+        std::error_code ec;
+        RunStats::Timer timer(RunStats::phaseRestore);
+        fs::path newPath = move.newPath();
+        fs::path originalPath = move.originalPath();
+        if (timedRename(newPath, originalPath, ec) ||
+            (ec == std::errc::cross_device_link && timedCopy(newPath, originalPath, ec))) {
+            result.status = RestoreResult::restored;
+            if (observer) {
+                observer->onMoved(newPath.string(), originalPath.string());
+            }
+        } else if (ec == std::errc::no_such_file_or_directory && !fs::exists(newPath)) {
+            result.status = RestoreResult::missing;
+        } else {
+            result.error = fs::filesystem_error("cannot rename", newPath, originalPath, ec).what();
+        }
+        return result;
+    }
+    
+    // Result of the --dedupe search over one set of collected files
+    struct DuplicateMatches {
+        std::vector<fs::path> existing;   // Files already in the category folders
+        std::vector<size_t> original;     // Per candidate (existing, then collected): the copy it duplicates
+        
+        bool isDuplicate(size_t file) const {
+            return !original.empty() && original[existing.size() + file] != DuplicateFinder::none;
+        }
+    };
+    
+    // Compares the collected files with each other and with what their
+    // category folders already hold. Existing files come first, so they are
+    // the copies that are kept.
+    DuplicateMatches findDuplicates(const std::string& folderPath, const CollectedFiles& files) {
+        RunStats::Timer timer(RunStats::phaseDedupe);
+        DuplicateMatches matches;
+        std::set<Category> categories(files.categories.begin(), files.categories.end());
+        for (Category category : categories) {
+            std::error_code ec;
+            scanDirectory(fs::path(categoryRoot(folderPath)) / folderName(category), [&](const ScannedEntry& entry) {
+                if (entry.isRegularFile && entry.name[0] != '.') {
+                    matches.existing.push_back(entry.path);
+                }
+            }, ec);
+        }
+        
+        std::vector<fs::path> candidates = matches.existing;
+        for (size_t i = 0; i < files.names.size(); ++i) {
+            candidates.push_back(files.path(i));
+        }
+        // Linking discards the duplicate's data, so a hash match is confirmed byte by byte first
+        matches.original = DuplicateFinder::find(candidates, options.jobs, options.dedupe == DedupeMode::link);
+        return matches;
+    }
+    
+    // Runs once every move of the batch is done, so kept copies that were
+    // collected themselves have their final paths. With --dedupe link each
+    // moved duplicate is swapped for a hard link to its kept copy; with skip
+    // the duplicates were never moved. Either way the action is journaled.
+    void applyDuplicates(const CollectedFiles& files, const DuplicateMatches& kept, const std::vector<FileMove>& slots,
+                         const std::vector<char>& moved) {
+        std::vector<DuplicateAction> actions;
+        std::uintmax_t savedBytes = 0;
+        for (size_t i = 0; i < files.names.size(); ++i) {
+            if (!kept.isDuplicate(i)) {
+                continue;
+            }
+            size_t original = kept.original[kept.existing.size() + i];
+            std::string keptPath;
+            if (original < kept.existing.size()) {
+                keptPath = kept.existing[original].string();
+            } else {
+                size_t keptFile = original - kept.existing.size();
+                keptPath = moved[keptFile] ? slots[keptFile].newPath() : files.path(keptFile).string();
+            }
+            
+            if (options.dedupe == DedupeMode::skip) {
+                actions.push_back({DuplicateAction::skipped, files.path(i).string(), keptPath});
+                continue;
+            }
+            if (!moved[i]) {
+                continue;
+            }
+            std::string newPath = slots[i].newPath();
+            std::error_code ec;
+            std::uintmax_t size = fs::file_size(newPath, ec);
+            if (replaceWithLink(newPath, keptPath)) {
+                actions.push_back({DuplicateAction::linked, newPath, keptPath});
+                savedBytes += ec ? 0 : size;
+            }
+        }
+        if (actions.empty()) {
+            return;
+        }
+        
+        if (options.dedupe == DedupeMode::skip) {
+            *output << "Skipped " << actions.size() << " duplicate files.\n";
+        } else {
+            *output << "Linked " << actions.size() << " duplicate files (" << formatFileSize(savedBytes) << " freed)."
+                    << '\n';
+        }
+        if (sessionWriter) {
+            sessionWriter->logDuplicates(actions);
+        } else {
+            duplicates.insert(duplicates.end(), actions.begin(), actions.end());
+        }
+    }
+    
+    // Atomically swaps path for a hard link to keptPath
+    static bool replaceWithLink(const std::string& path, const std::string& keptPath) {
+        fs::path target(path);
+        fs::path temporary = target.parent_path() / ("." + target.filename().string() + ".fileorganizer_link");
+        std::error_code ec;
+        fs::create_hard_link(keptPath, temporary, ec);
+        if (ec) {
+            return false;
+        }
+        fs::rename(temporary, target, ec);
+        if (ec) {
+            fs::remove(temporary, ec);
+            return false;
+        }
+        return true;
+    }
+    
+    // Gives a restored file that --dedupe had hard-linked its own copy of the data again
+    static bool detachLink(const std::string& path) {
+        fs::path target(path);
+        fs::path temporary = target.parent_path() / ("." + target.filename().string() + ".fileorganizer_copy");
+        std::error_code ec;
+        auto modified = fs::last_write_time(target, ec);
+        fs::copy_file(target, temporary, fs::copy_options::overwrite_existing, ec);
+        if (ec) {
+            return false;
+        }
+        fs::last_write_time(temporary, modified, ec);
+        fs::rename(temporary, target, ec);
+        if (ec) {
+            fs::remove(temporary, ec);
+            return false;
+        }
+        return true;
+    }
+    
+    // Overrides extension categories with content-sniffed ones. Files are
+    // sniffed in batches spread over the worker pool.
+    void applySniffedCategories(const CollectedFiles& files, std::vector<Category>& categories) {
+        RunStats::Timer timer(RunStats::phaseSniff);
+        size_t batches = (files.names.size() + sniffBatchSize - 1) / sniffBatchSize;
+        runParallel(batches, options.jobs, [&](size_t batch) {
+            size_t start = batch * sniffBatchSize;
+            size_t end = std::min(files.names.size(), start + sniffBatchSize);
+            std::vector<fs::path> paths;
+            std::vector<Category> byName(categories.begin() + start, categories.begin() + end);
+            for (size_t i = start; i < end; ++i) {
+                paths.push_back(files.path(i));
+            }
+            std::vector<Category> sniffed = ContentSniffer::classifyFiles(paths, byName);
+            for (size_t i = 0; i < sniffed.size(); ++i) {
+                if (sniffed[i] != Category::Others && !files.settled[start + i]) {
+                    categories[start + i] = sniffed[i];
+                }
+            }
+        });
+    }
+    
+    // For --layout date, the capture month (yyyymm) of every photo and video,
+    // read in parallel batches; 0 for other files and for the flat layout
+    std::vector<std::uint32_t> captureMonths(const CollectedFiles& files, const std::vector<Category>& categories) {
+        std::vector<std::uint32_t> months(files.names.size(), 0);
+        if (options.layout != FolderLayout::date) {
+            return months;
+        }
+        RunStats::Timer timer(RunStats::phaseMetadata);
+        size_t batches = (files.names.size() + sniffBatchSize - 1) / sniffBatchSize;
+        runParallel(batches, options.jobs, [&](size_t batch) {
+            size_t end = std::min(files.names.size(), (batch + 1) * sniffBatchSize);
+            for (size_t i = batch * sniffBatchSize; i < end; ++i) {
+                months[i] = captureMonth(categories[i], files.path(i));
+            }
+        });
+        return months;
+    }
+    
+    std::uint32_t captureMonth(Category category, const fs::path& path) const {
+        bool dated = options.layout == FolderLayout::date &&
+                     (category == Category::Images || category == Category::Videos);
+        return dated ? MediaDateReader::captureMonth(path) : 0;
+    }
+    
+    // A file's folder below the category root: the category folder, plus
+    // year and month levels when a capture month is known
+    std::string targetFolder(Category category, std::uint32_t month) const {
+        std::string folder = folderName(category);
+        if (month != 0) {
+            char levels[16];
+            std::snprintf(levels, sizeof(levels), "/%04u/%02u", static_cast<unsigned>(month / 100),
+                          static_cast<unsigned>(month % 100));
+            folder += levels;
+        }
+        return folder;
+    }
+    
+    // Adds a target folder and every folder above it, parents sorting first
+    void addTargetFolder(std::set<std::string>& folders, Category category, std::uint32_t month) const {
+        std::string folder = targetFolder(category, month);
+        for (size_t slash = folder.find('/'); slash != std::string::npos; slash = folder.find('/', slash + 1)) {
+            folders.insert(folder.substr(0, slash));
+        }
+        folders.insert(std::move(folder));
+    }
+    
+    // Returns a ready io_uring ring for the calling worker, or nullptr when
+    // the blocking std::filesystem path should be used
+    std::unique_ptr<IoUring> openRing() {
+        if (!ioUringActive) {
+            return nullptr;
+        }
+        auto ring = std::make_unique<IoUring>();
+        if (!ring->init(moveBatchSize)) {
+            return nullptr;
+        }
+        return ring;
+    }
+    
+    // Moves a batch of files. Target names are claimed up front so that, in
+    // write-ahead mode, the batch's intents can be journaled before anything
+    // moves. With a ring, the renames are submitted together as no-clobber
+    // renameat2 calls; only names taken behind our back (and filesystems
+    // that reject RENAME_NOREPLACE) go through the blocking path. File names
+    // for the records are stored in the worker's `arena`.
+    void moveBatch(std::vector<PendingMove>& batch, PathArena& arena, std::mutex& outputMutex, IoUring* ring) {
+        RunStats::Timer timer(RunStats::phaseMoveBatch);
+        for (auto& pending : batch) {
+            FileMove& record = *pending.record;
+            record.originalFolder = pending.sourceFolder;
+            record.name = pending.name;
+            pending.claimedName = pending.names->claim(pending.plannedName.empty() ? record.name : pending.plannedName);
+            record.newFolder = pending.targetDir;
+            record.newName = pending.claimedName == record.name ? record.name : arena.store(pending.claimedName);
+        }
+        if (planning) {
+            // The claimed names are the plan
+            for (auto& pending : batch) {
+                pending.moved = true;
+            }
+            return;
+        }
+        // Sizes go into the journal with the moves, so --history can total
+        // them later without visiting the files again
+        for (auto& pending : batch) {
+            std::error_code ec;
+            std::uintmax_t size = fs::file_size(pending.source, ec);
+            RunStats::count(RunStats::counterStat);
+            pending.record->size = ec ? FileMove::unknownSize : size;
+        }
+        IoThrottle::operations(batch.size());
+        
+        std::uint64_t batchId = 0;
+        if (sessionWriter) {
+            std::vector<FileMove> intents;
+            intents.reserve(batch.size());
+            for (const auto& pending : batch) {
+                intents.push_back(*pending.record);
+            }
+            batchId = sessionWriter->logIntents(intents);
+        }
+        
+        auto notify = [this](const PendingMove& pending) {
+            if (pending.moved && observer) {
+                observer->onMoved(pending.record->originalPath(), pending.record->newPath());
+            }
+        };
+        if (ring && ring->ready()) {
+            submitRenames(batch, arena, outputMutex, *ring);
+            std::for_each(batch.begin(), batch.end(), notify);
+        } else {
+            for (auto& pending : batch) {
+                pending.moved = moveFileToDirectory(pending.source, pending.targetDir, *pending.names, arena,
+                                                    *pending.record, outputMutex, pending.claimedName);
+                notify(pending);
+            }
+        }
+        
+        if (sessionWriter) {
+            std::vector<std::pair<std::uint32_t, std::string>> commits;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (batch[i].moved) {
+                    const FileMove& record = *batch[i].record;
+                    commits.emplace_back(static_cast<std::uint32_t>(i),
+                                         record.newName == batch[i].claimedName ? std::string() : record.newPath());
+                }
+            }
+            sessionWriter->logCommits(batchId, commits);
+        }
+    }
+    
+    void submitRenames(std::vector<PendingMove>& batch, PathArena& arena, std::mutex& outputMutex, IoUring& ring) {
+        PathArena scratch;   // NUL-terminated target paths, dropped with the batch
+        const int notRun = 1;   // No completion was reaped for this rename
+        for (size_t start = 0; start < batch.size(); start += ring.size()) {
+            if (!ring.ready()) {
+                // An earlier chunk broke the ring: the rest keep their claimed names
+                for (size_t i = start; i < batch.size(); ++i) {
+                    PendingMove& pending = batch[i];
+                    pending.moved = moveFileToDirectory(pending.source, pending.targetDir, *pending.names, arena,
+                                                        *pending.record, outputMutex, pending.claimedName);
+                }
+                return;
+            }
+            size_t count = std::min<size_t>(ring.size(), batch.size() - start);
+            std::vector<std::string> sources(count);
+            std::vector<std::string_view> targets(count);
+            std::vector<int> results(count, notRun);
+            for (size_t i = 0; i < count; ++i) {
+                const PendingMove& pending = batch[start + i];
+                sources[i] = pending.source.string();
+                targets[i] = scratch.join(pending.targetDir, pending.claimedName);
+                ring.queueRename(sources[i].c_str(), targets[i].data(), RENAME_NOREPLACE, i);
+            }
+            RunStats::count(RunStats::counterRename, count);
+            if (!ring.submitAndWait([&](std::uint64_t id, int result) { results[id] = result; })) {
+                // The ring failed mid-batch and has been drained and torn down.
+                // Renames without a completion either never ran or finished
+                // while we could not wait for them; anything still in place
+                // is retried under its claimed name.
+                for (size_t i = 0; i < count; ++i) {
+                    if (results[i] == notRun) {
+                        std::error_code ec;
+                        results[i] = (!fs::exists(sources[i], ec) && fs::exists(targets[i], ec)) ? 0 : -EINVAL;
+                    }
+                }
+            }
+            
+            for (size_t i = 0; i < count; ++i) {
+                PendingMove& pending = batch[start + i];
+                if (results[i] == 0) {
+                    pending.moved = true;
+                } else if (results[i] == -EEXIST) {
+                    pending.moved = moveFileToDirectory(pending.source, pending.targetDir, *pending.names, arena,
+                                                        *pending.record, outputMutex);
+                } else if (results[i] == -EINVAL || results[i] == -EXDEV) {
+                    // Keep the name already claimed for this file
+                    pending.moved = moveFileToDirectory(pending.source, pending.targetDir, *pending.names, arena,
+                                                        *pending.record, outputMutex, pending.claimedName);
+                } else {
+                    fs::filesystem_error error("cannot rename", pending.source, fs::path(targets[i]),
+                                               std::error_code(-results[i], std::system_category()));
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    *output << "Error moving " << pending.record->name << ": " << error.what() << '\n';
+                }
+            }
+        }
+    }
+    
+    // Moves one file into targetDir under a name claimed from `names`, never
+    // overwriting an existing file. `move` comes with its origin filled in;
+    // on success its new name is set (stored in `arena` when it differs)
+    // and true is returned. Errors are reported under outputMutex.
+    // `claimedName` lets a caller retry with a name it has already claimed.
+    bool moveFileToDirectory(const fs::path& source, std::string_view targetDir, DirectoryNameSet& names,
+                             PathArena& arena, FileMove& move, std::mutex& outputMutex,
+                             std::string_view claimedName = {}) {
+        for (;;) {
+            std::string_view newName = claimedName.empty() ? names.claim(move.name) : claimedName;
+            claimedName = {};
+            fs::path targetPath = joinPath(targetDir, newName);
+            
+            std::error_code ec;
+            if (timedRename(source, targetPath, ec) ||
+                (ec == std::errc::cross_device_link && timedCopy(source, targetPath, ec))) {
+                // Record the move for undo functionality
+                move.newFolder = targetDir;
+                if (newName != move.newName) {
+                    move.newName = newName == move.name ? move.name : arena.store(newName);
+                }
+                return true;
+            }
+            if (ec == std::errc::file_exists) {
+                // Created by someone else since the directory was scanned
+                continue;
+            }
+            
+            fs::filesystem_error error("cannot rename", source, targetPath, ec);
+            std::lock_guard<std::mutex> lock(outputMutex);
+            *output << "Error moving " << move.name << ": " << error.what() << '\n';
+            return false;
+        }
+    }
+    
+    static bool timedRename(const fs::path& from, const fs::path& to, std::error_code& ec) {
+        RunStats::Timer timer(RunStats::phaseRename);
+        RunStats::count(RunStats::counterRename);
+        bool renamed = renameNoReplace(from, to, ec);
+        if (ec == std::errc::file_exists) {
+            RunStats::count(RunStats::counterRenameConflict);
+        }
+        return renamed;
+    }
+    
+    bool timedCopy(const fs::path& from, const fs::path& to, std::error_code& ec) {
+        RunStats::Timer timer(RunStats::phaseCopy);
+        RunStats::count(RunStats::counterCrossDevice);
+        return moveAcrossDevices(from, to, options.jobs, ec);
+    }
+    
+    // Pure table lookup, safe to call from any worker
+    static Category getCategory(std::string_view filename) {
+        return ExtensionTable::lookup(extensionOf(filename));
+    }
+    
+    // User rules first, then the built-in extension table. ruled reports
+    // whether a rule decided, since content sniffing must not override it.
+    Category classify(const ScannedEntry& entry, bool& ruled) const {
+        return classify(entry.name, [&entry](std::error_code& ec) { return entry.status(ec); }, ruled);
+    }
+    
+    template <typename Status>
+    Category classify(std::string_view name, Status status, bool& ruled) const {
+        Category category = Category::Others;
+        ruled = rules->classify(name, status, category);
+        return ruled ? category : getCategory(name);
+    }
+    
+    const std::string& folderName(Category category) const {
+        return rules->folderName(category);
+    }
+    
+    // The folder the category folders are created in
+    const std::string& categoryRoot(const std::string& folderPath) const {
+        return options.targetRoot.empty() ? folderPath : options.targetRoot;
+    }
+    
+    void createCategoryFolders(const std::string& basePath, const std::set<std::string>& neededCategories,
+                               IoUring* ring = nullptr) {
+        RunStats::Timer timer(RunStats::phaseMkdir);
+        // Only create folders for categories that actually have files
+        fs::path basePathObj(basePath);
+        if (ring && ring->ready()) {
+            // Submit every mkdirat of one depth at once, so year folders exist
+            // before their months; EEXIST just means it is already there
+            std::map<size_t, std::vector<std::string>> levels;
+            for (const auto& folder : neededCategories) {
+                levels[std::count(folder.begin(), folder.end(), '/')].push_back((basePathObj / folder).string());
+            }
+            bool submitted = true;
+            for (const auto& level : levels) {
+                for (size_t i = 0; i < level.second.size(); ++i) {
+                    ring->queueMkdir(level.second[i].c_str(), 0777, i);
+                }
+                if (!ring->submitAndWait([](std::uint64_t, int) {})) {
+                    submitted = false;
+                    break;
+                }
+            }
+            if (submitted) {
+                return;
+            }
+        }
+        
+        for (const auto& folder : neededCategories) {
+            fs::path folderPath = basePathObj / folder;
+            try {
+                if (!fs::exists(folderPath)) {
+                    fs::create_directory(folderPath);
+                }
+            } catch (const fs::filesystem_error&) {
+                // Folder might already exist, that's okay
+            }
+        }
+    }
+    
+    bool isValidFile(const fs::path& filePath, const std::string& basePath) {
+        (void)basePath; // Mark as intentionally unused
+        std::string parentDir = filePath.parent_path().filename().string();
+        
+        // Skip hidden files, log files, and files already in category folders
+        return isValidName(filePath.filename().string()) && !isCategoryFolder(parentDir);
+    }
+    
+    static bool isValidName(std::string_view filename) {
+        return !filename.empty() && filename[0] != '.' && filename != UndoJournal::textLogFileName;
+    }
+    
+    bool isCategoryFolder(const std::string& name) {
+        return rules->isCategoryFolder(name);
+    }
+    
+    std::string getCurrentTimestamp() {
+        auto now = std::time(nullptr);
+        std::tm tm{};
+        // Several organizers may run at once (--batch, --serve)
+#ifdef _WIN32
+        localtime_s(&tm, &now);
+#else
+        localtime_r(&now, &tm);
+#endif
+        std::ostringstream oss;
+        oss << std::put_time(&tm, "%Y%m%d_%H%M%S");
+        return oss.str();
+    }
+    
+    void saveUndoLog(const std::string& folderPath, const std::vector<FileMove>& moves, const std::string& sessionId) {
+        if (moves.empty() && duplicates.empty()) {
+            return; // No moves to log
+        }
+        
+        // Single append of the whole session to the binary journal
+        UndoJournal journal = openJournal(folderPath);
+        bool saved = journal.appendSession(sessionId, moves, duplicates);
+        duplicates.clear();
+        if (!saved) {
+            *output << "Warning: could not write undo journal in " << folderPath << '\n';
+        }
+    }
+    
+    // Opens the folder's undo journal, converting a legacy text log first
+    UndoJournal openJournal(const std::string& folderPath) {
+        UndoJournal journal(folderPath);
+        if (!journal.exists()) {
+            int converted = UndoJournal::convertTextLog(folderPath);
+            if (converted >= 0) {
+                *output << "Converted text undo log to binary journal (" << converted << " sessions).\n";
+            }
+        }
+        return journal;
+    }
+    
+    // Removes the known category folders and any rule folder the undone
+    // moves came out of (rules may not be loaded for --undo) once empty
+    void removeEmptyCategories(const std::string& basePath, const std::vector<FileMove>& moves) {
+        // Moves share interned folders, so each folder is looked at once
+        std::unordered_set<std::string_view> movedTo;
+        for (const auto& move : moves) {
+            movedTo.insert(move.newFolder);
+        }
+        
+        std::vector<std::string> folders = rules->folderNames();
+        std::set<std::string> outside;   // Category folders created under another root (--target)
+        std::set<std::string> dateFolders;   // Year and month levels of --layout date
+        for (std::string_view movedFolder : movedTo) {
+            fs::path categoryFolder(movedFolder);
+            while (isDateLevel(categoryFolder.filename().string())) {
+                dateFolders.insert(categoryFolder.string());
+                categoryFolder = categoryFolder.parent_path();
+            }
+            fs::path relative = categoryFolder.lexically_relative(basePath);
+            std::string folder = relative.empty() ? std::string() : relative.begin()->string();
+            if (folder == "..") {
+                outside.insert(categoryFolder.string());
+            } else if (!folder.empty() && folder != "." &&
+                       std::find(folders.begin(), folders.end(), folder) == folders.end()) {
+                folders.push_back(folder);
+            }
+        }
+        
+        // Reverse order visits a month before its year
+        for (auto folder = dateFolders.rbegin(); folder != dateFolders.rend(); ++folder) {
+            std::error_code ec;
+            if (fs::is_empty(*folder, ec) && !ec) {
+                fs::remove(*folder, ec);
+            }
+        }
+        for (const std::string& folder : folders) {
+            std::string folderPath = basePath + "/" + folder;
+            try {
+                if (fs::exists(folderPath) && fs::is_directory(folderPath) && fs::is_empty(folderPath)) {
+                    fs::remove(folderPath);
+                    *output << "Removed empty folder: " << folder << '\n';
+                }
+            } catch (const fs::filesystem_error& e) {
+                // Ignore errors when removing directories
+            }
+        }
+        for (const std::string& folder : outside) {
+            std::error_code ec;
+            if (fs::is_empty(folder, ec) && fs::remove(folder, ec)) {
+                *output << "Removed empty folder: " << folder << '\n';
+            }
+        }
+    }
+    
+    std::string formatFileSize(std::uintmax_t size) {
+        const std::uintmax_t KB = 1024;
+        const std::uintmax_t MB = KB * 1024;
+        const std::uintmax_t GB = MB * 1024;
+        
+        if (size >= GB) {
+            return std::to_string(size / GB) + " GB";
+        } else if (size >= MB) {
+            return std::to_string(size / MB) + " MB";
+        } else if (size >= KB) {
+            return std::to_string(size / KB) + " KB";
+        } else {
+            return std::to_string(size) + " bytes";
+        }
+    }
+};
+
+// Minimal JSON reader/writer for the --serve protocol
+class JsonValue {
+public:
+    enum class Type { null, boolean, number, string, array, object };
+    
+    Type type = Type::null;
+    bool boolean = false;
+    double number = 0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::map<std::string, JsonValue> members;
+    
+    static bool parse(const std::string& input, JsonValue& value) {
+        size_t position = 0;
+        if (!parseValue(input, position, value, 0)) {
+            return false;
+        }
+        skipSpace(input, position);
+        return position == input.size();
+    }
+    
+    const JsonValue* get(const std::string& key) const {
+        auto it = members.find(key);
+        return it == members.end() ? nullptr : &it->second;
+    }
+    
+    // Scalars only: used to echo request ids back
+    std::string serialize() const {
+        switch (type) {
+            case Type::boolean: return boolean ? "true" : "false";
+            case Type::number: {
+                std::ostringstream out;
+                out << std::setprecision(17) << number;
+                return out.str();
+            }
+            case Type::string: return quote(text);
+            default: return "null";
+        }
+    }
+    
+    static std::string quote(const std::string& value) {
+        std::string quoted;
+        appendQuoted(quoted, value);
+        return quoted;
+    }
+    
+    // Appends value as a JSON string literal, without a temporary
+    static void appendQuoted(std::string& out, std::string_view value) {
+        out += '"';
+        for (unsigned char c : value) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char escape[8];
+                        std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                        out += escape;
+                    } else {
+                        out += static_cast<char>(c);
+                    }
+            }
+        }
+        out += '"';
+    }
+
+private:
+    static const int maxDepth = 64;
+    
+    static void skipSpace(const std::string& input, size_t& position) {
+        while (position < input.size() && std::isspace(static_cast<unsigned char>(input[position]))) {
+            ++position;
+        }
+    }
+    
+    static bool parseValue(const std::string& input, size_t& position, JsonValue& value, int depth) {
+        skipSpace(input, position);
+        if (position >= input.size() || depth > maxDepth) {
+            return false;
+        }
+        char c = input[position];
+        if (c == '{') {
+            value.type = Type::object;
+            ++position;
+            skipSpace(input, position);
+            if (position < input.size() && input[position] == '}') {
+                ++position;
+                return true;
+            }
+            for (;;) {
+                JsonValue key;
+                skipSpace(input, position);
+                if (position >= input.size() || input[position] != '"' || !parseString(input, position, key.text)) {
+                    return false;
+                }
+                skipSpace(input, position);
+                if (position >= input.size() || input[position++] != ':') {
+                    return false;
+                }
+                if (!parseValue(input, position, value.members[key.text], depth + 1)) {
+                    return false;
+                }
+                skipSpace(input, position);
+                if (position < input.size() && input[position] == ',') {
+                    ++position;
+                    continue;
+                }
+                return position < input.size() && input[position++] == '}';
+            }
+        }
+        if (c == '[') {
+            value.type = Type::array;
+            ++position;
+            skipSpace(input, position);
+            if (position < input.size() && input[position] == ']') {
+                ++position;
+                return true;
+            }
+            for (;;) {
+                value.items.emplace_back();
+                if (!parseValue(input, position, value.items.back(), depth + 1)) {
+                    return false;
+                }
+                skipSpace(input, position);
+                if (position < input.size() && input[position] == ',') {
+                    ++position;
+                    continue;
+                }
+                return position < input.size() && input[position++] == ']';
+            }
+        }
+        if (c == '"') {
+            value.type = Type::string;
+            return parseString(input, position, value.text);
+        }
+        for (const char* literal : {"true", "false", "null"}) {
+            size_t length = std::strlen(literal);
+            if (input.compare(position, length, literal) == 0) {
+                position += length;
+                value.type = literal[0] == 'n' ? Type::null : Type::boolean;
+                value.boolean = literal[0] == 't';
+                return true;
+            }
+        }
+        const char* start = input.c_str() + position;
+        char* end = nullptr;
+        value.number = std::strtod(start, &end);
+        if (end == start) {
+            return false;
+        }
+        value.type = Type::number;
+        position += static_cast<size_t>(end - start);
+        return true;
+    }
+    
+    static bool parseString(const std::string& input, size_t& position, std::string& text) {
+        ++position;   // Opening quote
+        while (position < input.size()) {
+            char c = input[position++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                text += c;
+                continue;
+            }
+            if (position >= input.size()) {
+                return false;
+            }
+            char escape = input[position++];
+            switch (escape) {
+                case 'n': text += '\n'; break;
+                case 'r': text += '\r'; break;
+                case 't': text += '\t'; break;
+                case 'b': text += '\b'; break;
+                case 'f': text += '\f'; break;
+                case 'u': {
+                    unsigned code = 0;
+                    if (!parseHex(input, position, code)) {
+                        return false;
+                    }
+                    // Surrogate pair
+                    if (code >= 0xD800 && code < 0xDC00 && input.compare(position, 2, "\\u") == 0) {
+                        unsigned low = 0;
+                        position += 2;
+                        if (!parseHex(input, position, low)) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(text, code);
+                    break;
+                }
+                default: text += escape;
+            }
+        }
+        return false;
+    }
+    
+    static bool parseHex(const std::string& input, size_t& position, unsigned& code) {
+        if (input.size() - position < 4) {
+            return false;
+        }
+        for (int i = 0; i < 4; ++i) {
+            char c = input[position++];
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= static_cast<unsigned>(c - '0');
+            else if (c >= 'a' && c <= 'f') code |= static_cast<unsigned>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') code |= static_cast<unsigned>(c - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+    
+    static void appendUtf8(std::string& text, unsigned code) {
+        if (code < 0x80) {
+            text += static_cast<char>(code);
+        } else if (code < 0x800) {
+            text += static_cast<char>(0xC0 | (code >> 6));
+            text += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            text += static_cast<char>(0xE0 | (code >> 12));
+            text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            text += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            text += static_cast<char>(0xF0 | (code >> 18));
+            text += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            text += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+// Machine-readable output for --output ndjson|binary: one record per file
+// listed, moved or restored and per progress, history or summary event.
+// Records are built in a per-thread scratch buffer, appended to one large
+// buffer under a lock and written out in big chunks: whenever the buffer
+// passes flushThreshold, on progress events and when the command ends.
+//
+// ndjson is one JSON object per line with an "event" member. binary starts
+// with the 8-byte magic "FORECS01"; each record is a u8 type, a u32 payload
+// length and the payload, in the journal's little-endian encoding (strings
+// are a u32 length and the bytes).
+class RecordStream : public OrganizerObserver {
+public:
+    enum class Format { ndjson, binary };
+    
+    enum RecordType : std::uint8_t {
+        recordListed = 1,     // path, category, u64 size
+        recordMoved = 2,      // from, to
+        recordProgress = 3,   // u64 done, u64 total
+        recordSession = 4,    // session ID, u64 files, u8 interrupted
+        recordFinished = 5    // session ID, u64 files
+    };
+    
+    RecordStream(Format format, std::FILE* sink) : format(format), sink(sink) {
+        buffer.reserve(flushThreshold + 64 * 1024);
+        if (format == Format::binary) {
+            buffer.append(binaryMagic);
+        }
+    }
+    
+    ~RecordStream() override {
+        flush();
+    }
+    
+    void onListed(const std::string& path, const std::string& category, std::uintmax_t size) override {
+        std::string& record = scratch();
+        if (format == Format::ndjson) {
+            record += "{\"event\":\"listed\",\"path\":";
+            JsonValue::appendQuoted(record, path);
+            record += ",\"category\":";
+            JsonValue::appendQuoted(record, category);
+            record += ",\"size\":" + std::to_string(size) + "}\n";
+        } else {
+            putString(record, path);
+            putString(record, category);
+            putU64(record, size);
+        }
+        emit(recordListed, record, false);
+    }
+    
+    void onMoved(const std::string& from, const std::string& to) override {
+        std::string& record = scratch();
+        if (format == Format::ndjson) {
+            record += "{\"event\":\"moved\",\"from\":";
+            JsonValue::appendQuoted(record, from);
+            record += ",\"to\":";
+            JsonValue::appendQuoted(record, to);
+            record += "}\n";
+        } else {
+            putString(record, from);
+            putString(record, to);
+        }
+        emit(recordMoved, record, false);
+    }
+    
+    void onProgress(size_t done, size_t total) override {
+        std::string& record = scratch();
+        if (format == Format::ndjson) {
+            record += "{\"event\":\"progress\",\"done\":" + std::to_string(done) + ",\"total\":" +
+                      std::to_string(total) + "}\n";
+        } else {
+            putU64(record, done);
+            putU64(record, total);
+        }
+        emit(recordProgress, record, true);
+    }
+    
+    void onSession(const std::string& sessionId, size_t files, bool interrupted) override {
+        std::string& record = scratch();
+        if (format == Format::ndjson) {
+            record += "{\"event\":\"session\",\"session\":";
+            JsonValue::appendQuoted(record, sessionId);
+            record += ",\"files\":" + std::to_string(files) + ",\"interrupted\":" + (interrupted ? "true" : "false") +
+                      "}\n";
+        } else {
+            putString(record, sessionId);
+            putU64(record, files);
+            record += static_cast<char>(interrupted ? 1 : 0);
+        }
+        emit(recordSession, record, false);
+    }
+    
+    void onFinished(const std::string& sessionId, size_t files) override {
+        std::string& record = scratch();
+        if (format == Format::ndjson) {
+            record += "{\"event\":\"finished\",\"session\":";
+            JsonValue::appendQuoted(record, sessionId);
+            record += ",\"files\":" + std::to_string(files) + "}\n";
+        } else {
+            putString(record, sessionId);
+            putU64(record, files);
+        }
+        emit(recordFinished, record, true);
+    }
+    
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeOut();
+    }
+    
+    static bool parseFormat(const std::string& name, Format& result) {
+        if (name == "ndjson") {
+            result = Format::ndjson;
+        } else if (name == "binary") {
+            result = Format::binary;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const size_t flushThreshold = 1 << 20;
+    inline static const std::string binaryMagic = "FORECS01";
+    
+    Format format;
+    std::FILE* sink;
+    std::mutex mutex;
+    std::string buffer;
+    
+    static std::string& scratch() {
+        thread_local std::string record;
+        record.clear();
+        return record;
+    }
+    
+    void emit(RecordType type, const std::string& record, bool flushNow) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (format == Format::binary) {
+            buffer += static_cast<char>(type);
+            putU32(buffer, static_cast<std::uint32_t>(record.size()));
+        }
+        buffer += record;
+        if (flushNow || buffer.size() >= flushThreshold) {
+            writeOut();
+        }
+    }
+    
+    void writeOut() {
+        if (!buffer.empty()) {
+            std::fwrite(buffer.data(), 1, buffer.size(), sink);
+            std::fflush(sink);
+            buffer.clear();
+        }
+    }
+};
+
+// A move plan written by --plan and carried out by --apply-plan: the folder
+// it was made for (which keeps the undo session), the root its category
+// folders go under, and every move with the exact name the file will get.
+//
+// The binary form starts with the 8-byte magic "FOPLAN02", followed by the
+// folder, the target root, a table of the folders involved (u32 count, then
+// the paths) and a u64 move count; each move is a u32 source folder index,
+// the file name, a u32 target folder index and the new name, empty when the
+// file keeps its name, in the journal's encoding. A plan file ending in
+// .ndjson or .jsonl holds a {"plan":1,"folder":...,"target":...,"moves":N}
+// line and one {"from":...,"to":...} line per move instead. Plans from
+// before the target root was recorded ("FOPLAN01", or no "target") are
+// taken to target the folder itself.
+//
+// A loaded plan is only accepted if every source sits directly in the
+// folder, every target folder lies under the target root, and no name is
+// empty, "." or ".." or contains a separator.
+class MovePlan {
+public:
+    std::string folder;
+    std::string targetRoot;         // Where the category folders go; the folder itself unless --target was given
+    PathPool paths;                 // Owns the text of every move
+    std::vector<FileMove> moves;
+    
+    static bool isNdjson(const std::string& path) {
+        auto endsWith = [&](std::string_view suffix) {
+            return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        return endsWith(".ndjson") || endsWith(".jsonl");
+    }
+    
+    bool save(const std::string& path) const {
+        std::string out;
+        if (isNdjson(path)) {
+            out += "{\"plan\":1,\"folder\":";
+            JsonValue::appendQuoted(out, folder);
+            out += ",\"target\":";
+            JsonValue::appendQuoted(out, targetRoot);
+            out += ",\"moves\":" + std::to_string(moves.size()) + "}\n";
+            for (const FileMove& move : moves) {
+                out += "{\"from\":";
+                JsonValue::appendQuoted(out, move.originalPath());
+                out += ",\"to\":";
+                JsonValue::appendQuoted(out, move.newPath());
+                out += "}\n";
+            }
+        } else {
+            // Folders are few, so each is written once and referred to by index
+            std::unordered_map<std::string_view, std::uint32_t> folderIndex;
+            std::vector<std::string_view> folders;
+            auto indexOf = [&](std::string_view folderPath) {
+                auto [entry, added] = folderIndex.try_emplace(folderPath, static_cast<std::uint32_t>(folders.size()));
+                if (added) {
+                    folders.push_back(folderPath);
+                }
+                return entry->second;
+            };
+            std::string records;
+            for (const FileMove& move : moves) {
+                putU32(records, indexOf(move.originalFolder));
+                putString(records, move.name);
+                putU32(records, indexOf(move.newFolder));
+                putString(records, move.newName == move.name ? std::string_view() : move.newName);
+            }
+            
+            out += binaryMagic;
+            putString(out, folder);
+            putString(out, targetRoot);
+            putU32(out, static_cast<std::uint32_t>(folders.size()));
+            for (std::string_view folderPath : folders) {
+                putString(out, folderPath);
+            }
+            putU64(out, moves.size());
+            out += records;
+        }
+        
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        return static_cast<bool>(file);
+    }
+    
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            error = "cannot read plan " + path;
+            return false;
+        }
+        std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        bool binary = buffer.compare(0, binaryMagic.size(), binaryMagic) == 0;
+        bool legacy = buffer.compare(0, legacyMagic.size(), legacyMagic) == 0;
+        bool loaded = binary || legacy ? loadBinary(buffer, legacy) : loadNdjson(buffer);
+        if (!loaded || folder.empty()) {
+            error = "not a valid move plan: " + path;
+            return false;
+        }
+        if (targetRoot.empty()) {
+            targetRoot = folder;
+        }
+        std::string problem = check();
+        if (!problem.empty()) {
+            error = "rejected move plan " + path + ": " + problem;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    inline static const std::string binaryMagic = "FOPLAN02";
+    inline static const std::string legacyMagic = "FOPLAN01";   // No target root
+    
+    // A plain file name that stays in the folder it is joined to
+    static bool isPlainName(std::string_view name) {
+        return !name.empty() && name != "." && name != ".." &&
+               name.find_first_of(pathSeparators) == std::string_view::npos &&
+               name.find('\0') == std::string_view::npos;
+    }
+    
+    // Whether `path` names something strictly below `root`, compared lexically
+    static bool isBelow(const fs::path& root, std::string_view path) {
+        fs::path relative = fs::path(path).lexically_normal().lexically_relative(root);
+        return !relative.empty() && relative != "." && *relative.begin() != "..";
+    }
+    
+    // Describes the first move that would reach outside what --plan could
+    // have produced, or returns an empty string
+    std::string check() const {
+        fs::path base = fs::path(folder).lexically_normal();
+        fs::path root = fs::path(targetRoot).lexically_normal();
+        if (targetRoot != folder && !fs::is_directory(targetRoot)) {
+            return "target folder does not exist: " + targetRoot;
+        }
+        for (const FileMove& move : moves) {
+            if (!isPlainName(move.name) || !isPlainName(move.newName)) {
+                return "invalid file name in move of " + move.originalPath();
+            }
+            if (fs::path(move.originalFolder).lexically_normal() != base) {
+                return "source is not in " + folder + ": " + move.originalPath();
+            }
+            if (!isBelow(root, move.newFolder)) {
+                return "target is not under " + targetRoot + ": " + move.newPath();
+            }
+        }
+        return "";
+    }
+    
+    bool loadBinary(const std::string& buffer, bool legacy) {
+        ByteReader reader(buffer.data() + binaryMagic.size(), buffer.size() - binaryMagic.size());
+        folder = reader.string();
+        if (!legacy) {
+            targetRoot = reader.string();
+        }
+        std::uint32_t folderCount = reader.u32();
+        std::vector<std::string_view> folders;
+        for (std::uint32_t i = 0; i < folderCount && reader.ok(); ++i) {
+            folders.push_back(paths.folder(reader.view()));
+        }
+        std::uint64_t count = reader.u64();
+        // A move takes at least 16 bytes, which bounds what a damaged count can reserve
+        moves.reserve(static_cast<size_t>(std::min<std::uint64_t>(count, buffer.size() / 16)));
+        for (std::uint64_t i = 0; i < count && reader.ok(); ++i) {
+            std::uint32_t from = reader.u32();
+            std::string_view name = reader.view();
+            std::uint32_t to = reader.u32();
+            std::string_view newName = reader.view();
+            if (!reader.ok() || from >= folders.size() || to >= folders.size() || name.empty()) {
+                return false;
+            }
+            FileMove move;
+            move.originalFolder = folders[from];
+            move.name = paths.store(name);
+            move.newFolder = folders[to];
+            move.newName = newName.empty() ? move.name : paths.store(newName);
+            moves.push_back(move);
+        }
+        return reader.ok() && reader.atEnd();
+    }
+    
+    bool loadNdjson(const std::string& buffer) {
+        std::istringstream lines(buffer);
+        std::string line;
+        bool header = true;
+        double expected = -1;
+        while (std::getline(lines, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            JsonValue value;
+            if (!JsonValue::parse(line, value)) {
+                return false;
+            }
+            if (header) {
+                const JsonValue* folderValue = value.get("folder");
+                const JsonValue* targetValue = value.get("target");
+                const JsonValue* countValue = value.get("moves");
+                if (!value.get("plan") || !folderValue || folderValue->type != JsonValue::Type::string ||
+                    (targetValue && targetValue->type != JsonValue::Type::string) ||
+                    !countValue || countValue->type != JsonValue::Type::number) {
+                    return false;
+                }
+                folder = folderValue->text;
+                if (targetValue) {
+                    targetRoot = targetValue->text;
+                }
+                expected = countValue->number;
+                header = false;
+                continue;
+            }
+            const JsonValue* from = value.get("from");
+            const JsonValue* to = value.get("to");
+            if (!from || !to || from->type != JsonValue::Type::string || to->type != JsonValue::Type::string) {
+                return false;
+            }
+            moves.push_back(paths.record(from->text, to->text));
+        }
+        // A truncated or padded plan is not the plan that was made
+        return !header && expected == static_cast<double>(moves.size());
+    }
+};
+
+// Organizes many folders in one run for --batch. Every folder is a task on
+// one WorkStealingPool with an organizer of its own, so it keeps its own undo
+// session and journal, while the batches inside large folders spread over
+// the same workers. A summary line is printed as each folder finishes.
+class BatchOrganizer {
+public:
+    BatchOrganizer(const OrganizerOptions& options, std::shared_ptr<const RuleSet> rules, std::ostream& output,
+                   OrganizerObserver* observer)
+        : options(options), rules(std::move(rules)), output(output), observer(observer) {
+        this->options.rulesFile.clear();
+        if (this->options.jobs <= 0) {
+            this->options.jobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+    }
+    
+    // One folder per line; blank lines and lines starting with '#' are skipped
+    static std::vector<std::string> readRoots(std::istream& input) {
+        std::vector<std::string> roots;
+        std::string line;
+        while (std::getline(input, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                roots.push_back(line);
+            }
+        }
+        return roots;
+    }
+    
+    // Returns the number of folders that could not be organized
+    size_t run(const std::vector<std::string>& roots) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            WorkStealingPool pool(static_cast<size_t>(options.jobs));
+            output << "Organizing " << roots.size() << " folders with " << pool.size() << " workers.\n";
+            for (const auto& root : roots) {
+                pool.submit([this, &root]() { organizeOne(root); });
+            }
+            pool.wait();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        output << "Batch completed! " << (roots.size() - failed) << " of " << roots.size() << " folders organized, "
+               << movedFiles << " files moved in " << std::fixed << std::setprecision(1) << seconds << "s.\n"
+               << std::defaultfloat;
+        if (failed > 0) {
+            output << failed << " folders failed; see the lines marked with x.\n";
+        }
+        output.flush();
+        return failed;
+    }
+
+private:
+    // Remembers how a folder's run ended and passes file records on
+    class FolderObserver : public OrganizerObserver {
+    public:
+        explicit FolderObserver(OrganizerObserver* next) : next(next) {}
         
-        std::ifstream file(logFile);
-        std::string line;
-        std::map<std::string, int> sessions;
-        
-        std::cout << "Organization history for: " << folderPath << std::endl;
-        std::cout << "----------------------------------------" << std::endl;
-        
-        while (std::getline(file, line)) {
-            if (line.find("SESSION:") == 0) {
-                std::string sessionId = line.substr(8);
-                sessions[sessionId]++;
+        void onMoved(const std::string& from, const std::string& to) override {
+            if (next) {
+                next->onMoved(from, to);
             }
         }
         
-        for (const auto& session : sessions) {
-            std::cout << "Session: " << session.first << " (" << session.second << " files moved)" << std::endl;
+        void onFinished(const std::string& sessionId, size_t files) override {
+            session = sessionId;
+            finishedFiles = files;
+            finished = true;
+            if (next) {
+                next->onFinished(sessionId, files);
+            }
         }
         
-        if (sessions.empty()) {
-            std::cout << "No sessions found." << std::endl;
-        }
-    }
+        std::string session;
+        size_t finishedFiles = 0;
+        bool finished = false;
     
-    void undoOrganization(const std::string& folderPath, const std::string& sessionId = "") {
-        std::string logFile = folderPath + "/.fileorganizer_log.txt";
+    private:
+        OrganizerObserver* next;
+    };
+    
+    OrganizerOptions options;
+    std::shared_ptr<const RuleSet> rules;
+    std::ostream& output;
+    OrganizerObserver* observer;
+    std::mutex outputMutex;
+    size_t failed = 0;
+    size_t movedFiles = 0;
+    
+    void organizeOne(const std::string& root) {
+        SimpleFileOrganizer organizer;
+        organizer.setOptions(options);
+        organizer.setRules(rules);
+        std::ostringstream text;
+        organizer.setOutput(text, false);
+        FolderObserver folderObserver(observer);
+        organizer.setObserver(&folderObserver);
+        organizer.organizeFolder(root);
         
-        if (!fs::exists(logFile)) {
-            std::cout << "No undo log found for this folder." << std::endl;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if (folderObserver.finished) {
+            movedFiles += folderObserver.finishedFiles;
+            output << "  ✓ " << root << ": " << folderObserver.finishedFiles << " files (session "
+                   << folderObserver.session << ")\n";
             return;
         }
-        
-        std::vector<FileMove> movesToUndo;
-        std::ifstream file(logFile);
+        // Nothing moved: report the organizer's last message, usually why
         std::string line;
-        std::string currentSession;
-        
-        // Read the log file
-        while (std::getline(file, line)) {
-            if (line.find("SESSION:") == 0) {
-                currentSession = line.substr(8);
-            } else if (line.find("MOVE:") == 0 && (sessionId.empty() || currentSession == sessionId)) {
-                // Parse move line: MOVE:originalPath|newPath
-                std::string moveInfo = line.substr(5);
-                size_t pos = moveInfo.find('|');
-                if (pos != std::string::npos) {
-                    FileMove move;
-                    move.originalPath = moveInfo.substr(0, pos);
-                    move.newPath = moveInfo.substr(pos + 1);
-                    move.timestamp = currentSession;
-                    movesToUndo.push_back(move);
-                }
+        std::string last;
+        for (std::istringstream lines(text.str()); std::getline(lines, line);) {
+            if (!line.empty()) {
+                last = line;
             }
         }
-        file.close();
+        bool error = last.rfind("Error", 0) == 0;
+        if (error) {
+            failed++;
+        }
+        output << (error ? "  x " : "  - ") << root << ": " << last << '\n';
+    }
+};
+
+#ifndef _WIN32
+// Long-lived JSON-RPC 2.0 server for --serve. Clients connect over a Unix
+// socket or a loopback TCP port and send one request object per line:
+//
+//   {"jsonrpc":"2.0","id":1,"method":"list","params":{"folder":"/data"}}
+//
+// Methods are list, organize, undo and history; params may also override
+// recursive, sniff, jobs, writeAhead and ioUring. The Unix socket is only
+// accessible to its owner; on a TCP port every request must also carry the
+// "token" printed at startup. A connection is closed on the first line that
+// is not a valid JSON-RPC request, so stray text such as an HTTP request from
+// a browser never gets a line executed. Requests wait in a bounded
+// queue for a fixed pool of workers and are refused with "server busy" when
+// it is full. Read-only requests on a folder run concurrently; organize and
+// undo take that folder exclusively. Long operations stream
+// {"method":"progress"} notifications before the final response.
+class RpcServer {
+public:
+    RpcServer(const OrganizerOptions& baseOptions, std::shared_ptr<const RuleSet> rules)
+        : baseOptions(baseOptions), rules(std::move(rules)), requests(queueCapacity) {
+        this->baseOptions.rulesFile.clear();
+    }
+    
+    // Listens on a TCP port (127.0.0.1) when address is a number, otherwise
+    // on a Unix socket at that path. Only returns on a setup error.
+    bool run(const std::string& address) {
+        std::signal(SIGPIPE, SIG_IGN);
+        int listener = openListener(address);
+        if (listener < 0) {
+            std::cout << "Error: cannot listen on " << address << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::cout << "Listening on " << address;
+        if (!token.empty()) {
+            std::cout << " token " << token;
+        }
+        std::cout << std::endl;
         
-        if (movesToUndo.empty()) {
-            if (sessionId.empty()) {
-                std::cout << "No moves found to undo." << std::endl;
-            } else {
-                std::cout << "No moves found for session: " << sessionId << std::endl;
+        for (size_t w = 0; w < workerCount; ++w) {
+            std::thread(&RpcServer::workerLoop, this).detach();
+        }
+        for (;;) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                std::cout << "Error: accept failed: " << std::strerror(errno) << std::endl;
+                close(listener);
+                return false;
             }
-            return;
+            if (connections.fetch_add(1) >= maxConnections) {
+                connections--;
+                close(client);
+                continue;
+            }
+            auto connection = std::make_shared<Connection>(client);
+            std::thread([this, connection]() {
+                readLoop(connection);
+                connections--;
+            }).detach();
         }
+    }
+
+private:
+    static const size_t workerCount = 4;
+    static const size_t queueCapacity = 64;
+    static const int maxConnections = 64;
+    static const size_t maxLineLength = 1 << 20;
+    
+    // JSON-RPC error codes
+    static const int parseError = -32700;
+    static const int invalidRequest = -32600;
+    static const int methodNotFound = -32601;
+    static const int invalidParams = -32602;
+    static const int serverBusy = -32000;
+    static const int unauthorized = -32001;
+    
+    struct Connection {
+        explicit Connection(int fd) : fd(fd) {}
+        ~Connection() { close(fd); }
         
-        // Sort moves in reverse order (undo most recent first)
-        std::reverse(movesToUndo.begin(), movesToUndo.end());
-        
-        std::cout << "Undoing " << movesToUndo.size() << " file moves..." << std::endl;
-        std::cout << "----------------------------------------" << std::endl;
-        
-        int undoCount = 0;
-        for (const auto& move : movesToUndo) {
-            try {
-                if (fs::exists(move.newPath)) {
-                    fs::rename(move.newPath, move.originalPath);
-                    undoCount++;
-                    std::cout << "✓ Restored: " << fs::path(move.originalPath).filename().string() << std::endl;
-                } else {
-                    std::cout << "⚠ File not found: " << fs::path(move.newPath).filename().string() << std::endl;
+        // Whole lines only, so concurrent responses never interleave
+        void send(const std::string& line) {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            std::string data = line + "\n";
+            size_t sent = 0;
+            while (sent < data.size()) {
+                ssize_t written = ::send(fd, data.data() + sent, data.size() - sent, 0);
+                if (written < 0 && errno == EINTR) {
+                    continue;
                 }
-            } catch (const fs::filesystem_error& e) {
-                std::cout << "❌ Error restoring " << fs::path(move.originalPath).filename().string() << ": " << e.what() << std::endl;
+                if (written <= 0) {
+                    return;   // Client went away; the request still completes
+                }
+                sent += static_cast<size_t>(written);
             }
         }
         
-        // Clean up empty category folders
-        removeEmptyCategories(folderPath);
+        int fd;
+        std::mutex sendMutex;
+    };
+    
+    struct Request {
+        std::shared_ptr<Connection> connection;
+        std::string id;       // Serialized, echoed back verbatim
+        std::string method;
+        JsonValue params;
+    };
+    
+    // Collects structured results and forwards progress as notifications
+    class RequestObserver : public OrganizerObserver {
+    public:
+        RequestObserver(Connection& connection, const std::string& id) : connection(connection), id(id) {}
         
-        // Remove the undone moves from the log
-        if (!sessionId.empty()) {
-            removeSessionFromLog(folderPath, sessionId);
+        void onListed(const std::string& path, const std::string& category, std::uintmax_t size) override {
+            files += std::string(files.empty() ? "" : ",") + "{\"path\":" + JsonValue::quote(path) +
+                     ",\"category\":" + JsonValue::quote(category) + ",\"size\":" + std::to_string(size) + "}";
         }
         
-        std::cout << "----------------------------------------" << std::endl;
-        std::cout << "Undo completed! Restored " << undoCount << " files." << std::endl;
-    }
-
-private:
-    std::string getCategory(const std::string& extension) {
-        // Use static cache for repeated extension lookups
-        static std::unordered_map<std::string, std::string> categoryCache;
-        
-        // Check cache first for better performance
-        auto cacheIt = categoryCache.find(extension);
-        if (cacheIt != categoryCache.end()) {
-            return cacheIt->second;
+        void onProgress(size_t done, size_t total) override {
+            connection.send("{\"jsonrpc\":\"2.0\",\"method\":\"progress\",\"params\":{\"id\":" + id +
+                            ",\"done\":" + std::to_string(done) + ",\"total\":" + std::to_string(total) + "}}");
         }
         
-        // Not in cache, look up in main map
-        auto it = extensionCategories.find(extension);
-        std::string category = (it != extensionCategories.end()) ? it->second : "Others";
+        void onSession(const std::string& sessionId, size_t count, bool interrupted) override {
+            sessions += std::string(sessions.empty() ? "" : ",") + "{\"session\":" + JsonValue::quote(sessionId) +
+                        ",\"files\":" + std::to_string(count) + ",\"interrupted\":" + (interrupted ? "true" : "false") + "}";
+        }
         
-        // Add to cache for future lookups
-        categoryCache[extension] = category;
+        void onFinished(const std::string& sessionId, size_t count) override {
+            session = sessionId;
+            finishedFiles = count;
+        }
         
-        return category;
-    }
+        Connection& connection;
+        std::string id;
+        std::string files;
+        std::string sessions;
+        std::string session;
+        size_t finishedFiles = 0;
+    };
     
-    void createCategoryFolders(const std::string& basePath, const std::set<std::string>& neededCategories) {
-        // Only create folders for categories that actually have files
-        fs::path basePathObj(basePath);
-        for (const auto& folder : neededCategories) {
-            fs::path folderPath = basePathObj / folder;
-            try {
-                if (!fs::exists(folderPath)) {
-                    fs::create_directory(folderPath);
-                }
-            } catch (const fs::filesystem_error&) {
-                // Folder might already exist, that's okay
-            }
+    OrganizerOptions baseOptions;
+    std::shared_ptr<const RuleSet> rules;
+    BoundedQueue<Request> requests;
+    std::atomic<int> connections{0};
+    std::mutex folderLocksMutex;
+    std::map<std::string, std::shared_ptr<std::shared_mutex>> folderLocks;
+    std::string token;   // Required on every request when listening on TCP
+    
+    // 128 random bits as hex, or empty if no randomness is available
+    static std::string randomToken() {
+        unsigned char bytes[16];
+        std::ifstream random("/dev/urandom", std::ios::binary);
+        if (!random.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+            return "";
         }
+        static const char digits[] = "0123456789abcdef";
+        std::string text;
+        for (unsigned char byte : bytes) {
+            text += digits[byte >> 4];
+            text += digits[byte & 0xF];
+        }
+        return text;
     }
     
-    bool isValidFile(const fs::path& filePath, const std::string& basePath) {
-        (void)basePath; // Mark as intentionally unused
-        std::string filename = filePath.filename().string();
-        std::string parentDir = filePath.parent_path().filename().string();
-        
-        // Skip hidden files, log files, and files already in category folders
-        if (filename[0] == '.' || 
-            filename == ".fileorganizer_log.txt" ||
-            parentDir == "Images" || parentDir == "Videos" || 
-            parentDir == "Music" || parentDir == "Documents" || 
-            parentDir == "Others") {
+    // Compares without stopping at the first difference
+    bool tokenMatches(const std::string& candidate) const {
+        if (candidate.size() != token.size()) {
             return false;
         }
-        
-        return true;
+        unsigned char difference = 0;
+        for (size_t i = 0; i < token.size(); ++i) {
+            difference |= static_cast<unsigned char>(candidate[i] ^ token[i]);
+        }
+        return difference == 0;
     }
     
-    std::string getUniqueFilePath(const std::string& originalPath) {
-        if (!fs::exists(originalPath)) {
-            return originalPath; // Fast path for most files
+    int openListener(const std::string& address) {
+        bool isPort = !address.empty() && std::all_of(address.begin(), address.end(), ::isdigit);
+        int fd = -1;
+        if (isPort) {
+            token = randomToken();
+            if (token.empty()) {
+                errno = EIO;
+                return -1;
+            }
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                return -1;
+            }
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            sockaddr_in local{};
+            local.sin_family = AF_INET;
+            local.sin_port = htons(static_cast<std::uint16_t>(std::stoi(address)));
+            local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+                close(fd);
+                return -1;
+            }
+        } else {
+            sockaddr_un local{};
+            if (address.size() >= sizeof(local.sun_path)) {
+                errno = ENAMETOOLONG;
+                return -1;
+            }
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                return -1;
+            }
+            local.sun_family = AF_UNIX;
+            std::memcpy(local.sun_path, address.c_str(), address.size() + 1);
+            unlink(address.c_str());   // Stale socket from an earlier run
+            // Owner only; nobody can connect before listen(), so there is no window
+            if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+                chmod(address.c_str(), S_IRUSR | S_IWUSR) != 0) {
+                int error = errno;
+                close(fd);
+                errno = error;
+                return -1;
+            }
         }
-        
-        // Use filesystem library for path manipulation (more efficient)
-        fs::path path(originalPath);
-        fs::path directory = path.parent_path();
-        std::string stem = path.stem().string();
-        std::string extension = path.extension().string();
-        
-        // Start with a reasonable counter to avoid too many checks for large duplicates
-        int counter = 1;
-        fs::path newPath;
-        
-        // Try to find a unique name with minimal filesystem checks
-        do {
-            // Use path concatenation instead of string concatenation
-            newPath = directory / (stem + "_" + std::to_string(counter++) + extension);
-        } while (fs::exists(newPath) && counter < 10000); // Avoid infinite loops
-        
-        return newPath.string();
+        if (listen(fd, 64) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
     }
     
-    std::string getCurrentTimestamp() {
-        auto now = std::time(nullptr);
-        auto tm = *std::localtime(&now);
-        std::ostringstream oss;
-        oss << std::put_time(&tm, "%Y%m%d_%H%M%S");
-        return oss.str();
+    void readLoop(const std::shared_ptr<Connection>& connection) {
+        std::string pending;
+        char buffer[64 * 1024];
+        for (;;) {
+            ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return;
+            }
+            pending.append(buffer, static_cast<size_t>(received));
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, newline);
+                pending.erase(0, newline + 1);
+                if (line.find_first_not_of(" \t\r") != std::string::npos && !enqueue(connection, line)) {
+                    return;
+                }
+            }
+            if (pending.size() > maxLineLength) {
+                connection->send(errorResponse("null", invalidRequest, "request too large"));
+                return;
+            }
+        }
     }
     
-    void saveUndoLog(const std::string& folderPath, const std::vector<FileMove>& moves, const std::string& sessionId) {
-        if (moves.empty()) {
-            return; // No moves to log
+    // Validates one request line and queues it for the workers. Returns
+    // false when the line is not a valid (or not an authorized) JSON-RPC
+    // request, after which the connection is dropped.
+    bool enqueue(const std::shared_ptr<Connection>& connection, const std::string& line) {
+        JsonValue message;
+        if (!JsonValue::parse(line, message) || message.type != JsonValue::Type::object) {
+            connection->send(errorResponse("null", parseError, "invalid JSON"));
+            return false;
         }
-        
-        std::string logFile = folderPath + "/.fileorganizer_log.txt";
-        
-        // Pre-allocate a string buffer for better performance with many files
-        std::stringstream buffer;
-        buffer << "SESSION:" << sessionId << std::endl;
-        
-        for (const auto& move : moves) {
-            buffer << "MOVE:" << move.originalPath << "|" << move.newPath << std::endl;
+        const JsonValue* id = message.get("id");
+        const JsonValue* version = message.get("jsonrpc");
+        const JsonValue* method = message.get("method");
+        std::string idText = id ? id->serialize() : "null";
+        if (!version || version->type != JsonValue::Type::string || version->text != "2.0" ||
+            !method || method->type != JsonValue::Type::string) {
+            connection->send(errorResponse(idText, invalidRequest, "not a JSON-RPC 2.0 request"));
+            return false;
+        }
+        if (!token.empty()) {
+            const JsonValue* given = message.get("token");
+            if (!given || given->type != JsonValue::Type::string || !tokenMatches(given->text)) {
+                connection->send(errorResponse(idText, unauthorized, "missing or wrong token"));
+                return false;
+            }
         }
-        buffer << "END_SESSION:" << sessionId << std::endl;
         
-        // Single file write operation
-        std::ofstream file(logFile, std::ios::app);
-        file << buffer.str();
-        file.close();
+        Request request{connection, idText, method->text, JsonValue()};
+        if (const JsonValue* params = message.get("params")) {
+            request.params = *params;
+        }
+        if (!requests.tryPush(std::move(request))) {
+            connection->send(errorResponse(idText, serverBusy, "server busy, request queue is full"));
+        }
+        return true;
     }
     
-    void removeEmptyCategories(const std::string& basePath) {
-        std::vector<std::string> folders = {"Images", "Videos", "Music", "Documents", "Others"};
-        
-        for (const std::string& folder : folders) {
-            std::string folderPath = basePath + "/" + folder;
-            try {
-                if (fs::exists(folderPath) && fs::is_directory(folderPath) && fs::is_empty(folderPath)) {
-                    fs::remove(folderPath);
-                    std::cout << "Removed empty folder: " << folder << std::endl;
-                }
-            } catch (const fs::filesystem_error& e) {
-                // Ignore errors when removing directories
-            }
+    void workerLoop() {
+        Request request;
+        while (requests.pop(request)) {
+            request.connection->send(execute(request));
+            request = Request();
         }
     }
     
-    void removeSessionFromLog(const std::string& folderPath, const std::string& sessionId) {
-        std::string logFile = folderPath + "/.fileorganizer_log.txt";
-        std::string tempFile = logFile + ".tmp";
+    std::string execute(const Request& request) {
+        bool readOnly = request.method == "list" || request.method == "history";
+        if (!readOnly && request.method != "organize" && request.method != "undo") {
+            return errorResponse(request.id, methodNotFound, "unknown method " + request.method);
+        }
+        const JsonValue* folder = request.params.get("folder");
+        if (!folder || folder->type != JsonValue::Type::string || folder->text.empty()) {
+            return errorResponse(request.id, invalidParams, "params.folder is required");
+        }
+        std::error_code ec;
+        if (!fs::is_directory(folder->text, ec)) {
+            return errorResponse(request.id, invalidParams, "folder does not exist: " + folder->text);
+        }
         
-        std::ifstream input(logFile);
-        std::ofstream output(tempFile);
-        std::string line;
-        bool skipSession = false;
+        OrganizerOptions options = requestOptions(request.params);
+        SimpleFileOrganizer organizer;
+        organizer.setOptions(options);
+        organizer.setRules(rules);
+        std::ostringstream text;
+        organizer.setOutput(text);
+        RequestObserver observer(*request.connection, request.id);
+        organizer.setObserver(&observer);
         
-        while (std::getline(input, line)) {
-            if (line == "SESSION:" + sessionId) {
-                skipSession = true;
-                continue;
-            } else if (line == "END_SESSION:" + sessionId) {
-                skipSession = false;
-                continue;
+        std::shared_ptr<std::shared_mutex> lock = folderLock(folder->text);
+        std::string result;
+        if (readOnly) {
+            std::shared_lock<std::shared_mutex> guard(*lock);
+            if (request.method == "list") {
+                organizer.listFiles(folder->text);
+                result = "\"files\":[" + observer.files + "]";
+            } else {
+                organizer.showUndoHistory(folder->text);
+                result = "\"sessions\":[" + observer.sessions + "]";
             }
-            
-            if (!skipSession) {
-                output << line << std::endl;
+        } else {
+            std::unique_lock<std::shared_mutex> guard(*lock);
+            if (request.method == "organize") {
+                organizer.organizeFolder(folder->text);
+                result = "\"session\":" + JsonValue::quote(observer.session) + ",\"moved\":" +
+                         std::to_string(observer.finishedFiles);
+            } else {
+                const JsonValue* session = request.params.get("session");
+                organizer.undoOrganization(folder->text, session && session->type == JsonValue::Type::string
+                                                         ? session->text : "");
+                result = "\"session\":" + JsonValue::quote(observer.session) + ",\"restored\":" +
+                         std::to_string(observer.finishedFiles);
             }
         }
-        
-        input.close();
-        output.close();
-        
-        fs::remove(logFile);
-        fs::rename(tempFile, logFile);
+        return "{\"jsonrpc\":\"2.0\",\"id\":" + request.id + ",\"result\":{" + result + ",\"output\":" +
+               JsonValue::quote(text.str()) + "}}";
     }
     
-    std::string formatFileSize(std::uintmax_t size) {
-        const std::uintmax_t KB = 1024;
-        const std::uintmax_t MB = KB * 1024;
-        const std::uintmax_t GB = MB * 1024;
-        
-        if (size >= GB) {
-            return std::to_string(size / GB) + " GB";
-        } else if (size >= MB) {
-            return std::to_string(size / MB) + " MB";
-        } else if (size >= KB) {
-            return std::to_string(size / KB) + " KB";
-        } else {
-            return std::to_string(size) + " bytes";
+    OrganizerOptions requestOptions(const JsonValue& params) const {
+        OrganizerOptions options = baseOptions;
+        auto flag = [&](const char* name, bool& target) {
+            const JsonValue* value = params.get(name);
+            if (value && value->type == JsonValue::Type::boolean) {
+                target = value->boolean;
+            }
+        };
+        flag("recursive", options.recursive);
+        flag("sniff", options.sniff);
+        flag("writeAhead", options.writeAhead);
+        flag("ioUring", options.ioUring);
+        const JsonValue* jobs = params.get("jobs");
+        if (jobs && jobs->type == JsonValue::Type::number && jobs->number >= 0 && jobs->number <= 1024) {
+            options.jobs = static_cast<int>(jobs->number);
+        }
+        return options;
+    }
+    
+    // One reader/writer lock per folder, keyed by its canonical path
+    std::shared_ptr<std::shared_mutex> folderLock(const std::string& folder) {
+        std::error_code ec;
+        std::string key = fs::weakly_canonical(folder, ec).string();
+        if (ec) {
+            key = folder;
+        }
+        std::lock_guard<std::mutex> guard(folderLocksMutex);
+        auto& lock = folderLocks[key];
+        if (!lock) {
+            lock = std::make_shared<std::shared_mutex>();
         }
+        return lock;
+    }
+    
+    static std::string errorResponse(const std::string& id, int code, const std::string& message) {
+        return "{\"jsonrpc\":\"2.0\",\"id\":" + id + ",\"error\":{\"code\":" + std::to_string(code) +
+               ",\"message\":" + JsonValue::quote(message) + "}}";
     }
 };
+#endif
 
 void showHelp() {
     std::cout << "FileOrganizer v1.0 - Professional File Organization Tool" << std::endl;
@@ -486,7 +7660,7 @@ void showHelp() {
     std::cout << "  Features complete undo functionality with session tracking for safe file operations." << std::endl;
     std::cout << std::endl;
     std::cout << "USAGE:" << std::endl;
-    std::cout << "  FileOrganizer [OPTION] <folder_path> [session_id]" << std::endl;
+    std::cout << "  FileOrganizer [OPTION] <folder_path> [session_id] [--jobs N] [--recursive]" << std::endl;
     std::cout << std::endl;
     std::cout << "OPTIONS:" << std::endl;
     std::cout << "  --organize <folder>         Organize files in the specified folder" << std::endl;
@@ -495,6 +7669,11 @@ void showHelp() {
     std::cout << "  --list <folder>             Preview organization without moving files" << std::endl;
     std::cout << "                              Shows which files will go into which categories" << std::endl;
     std::cout << std::endl;
+    std::cout << "  --plan <folder> <file>      Write the exact moves --organize would make, names included" << std::endl;
+    std::cout << "                              Binary plan, or NDJSON when the file ends in .ndjson/.jsonl" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --apply-plan <file>         Carry out a plan written by --plan as one undoable session" << std::endl;
+    std::cout << std::endl;
     std::cout << "  --undo <folder> [session]   Restore files to their original locations" << std::endl;
     std::cout << "                              If session ID provided, undo specific session only" << std::endl;
     std::cout << "                              If no session ID, undo the most recent organization" << std::endl;
@@ -502,6 +7681,61 @@ void showHelp() {
     std::cout << "  --history <folder>          Show all organization sessions for the folder" << std::endl;
     std::cout << "                              Displays session IDs, timestamps, and file counts" << std::endl;
     std::cout << std::endl;
+    std::cout << "  --jobs <N>                  Move files with N worker threads (with --organize/--undo)" << std::endl;
+    std::cout << "                              Use 0 for one worker per CPU core (default: 1)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --recursive                 Include files in nested folders (with --organize/--list)" << std::endl;
+    std::cout << "                              Files are moved while the scan is still running" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --sniff                     Detect file types from their content (with --organize/--list)" << std::endl;
+    std::cout << "                              Catches extensionless and mislabelled files" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --dedupe <link|skip>        Handle byte-identical files (with --organize)" << std::endl;
+    std::cout << "                              link: hard-link to the kept copy, skip: leave in place" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --rules <file>              Apply user-defined category rules (with --organize/--list)" << std::endl;
+    std::cout << "                              Matches extensions, globs, regexes, sizes and dates" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --target <folder>           Create the category folders there instead (with --organize)" << std::endl;
+    std::cout << "                              May be on another drive; files are then copied and verified" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --layout <flat|date>        date: put photos and videos in Images/2026/10 style folders" << std::endl;
+    std::cout << "                              by EXIF or MP4/MOV capture date, else modification time" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --max-ops <N>               Move or restore at most N files per second" << std::endl;
+    std::cout << "  --max-bandwidth <rate>      Copy at most this many bytes per second across drives (500K, 20M)" << std::endl;
+    std::cout << "  --nice <0-19>               Run with a lower CPU priority" << std::endl;
+    std::cout << "  --ioprio <idle|be:0-7>      Run with a lower disk I/O priority (Linux)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --stats                     Print per-phase timings and system call counts afterwards" << std::endl;
+    std::cout << "  --stats-json                The same as one JSON line" << std::endl;
+    std::cout << "  --trace <file>              Write a Chrome trace (chrome://tracing, Perfetto) of the run" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --output <text|ndjson|binary>" << std::endl;
+    std::cout << "                              Stream one record per file to stdout for other programs" << std::endl;
+    std::cout << "                              (summaries and errors then go to stderr)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --io-uring                  Batch renames through io_uring on Linux (with --organize/--undo)" << std::endl;
+    std::cout << "                              Falls back to standard file operations if unsupported" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --write-ahead               Journal undo records while files move (with --organize)" << std::endl;
+    std::cout << "                              An interrupted run can still be undone" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --fsync <policy>            When --write-ahead forces the journal to disk:" << std::endl;
+    std::cout << "                              batch (default, before each batch), session, never" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --watch <folder>            Keep organizing new files as they arrive (Linux)" << std::endl;
+    std::cout << "                              Batches are journaled as hourly undo sessions" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --convert-log <folder>      Convert a legacy text undo log to the binary journal" << std::endl;
+    std::cout << "                              (also done automatically on first use)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --batch <file|->            Organize every folder listed in a file (or stdin), one per line" << std::endl;
+    std::cout << "                              Folders share one worker pool and keep their own undo sessions" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --serve <port|socket>       Run as a JSON-RPC server on a local TCP port or Unix socket" << std::endl;
+    std::cout << "                              Serves list, organize, undo and history requests" << std::endl;
+    std::cout << std::endl;
     std::cout << "  --interactive               Launch guided interactive mode" << std::endl;
     std::cout << "                              Recommended for first-time users" << std::endl;
     std::cout << std::endl;
@@ -619,7 +7853,91 @@ void interactiveMode() {
     }
 }
 
+// Parses a non-negative integer option value, returning false on bad input
+bool parseCountOption(const std::string& value, int& result) {
+    if (value.empty() || !std::all_of(value.begin(), value.end(), ::isdigit)) {
+        return false;
+    }
+    try {
+        result = std::stoi(value);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Parses a byte rate such as 500000, 512K, 20M or 1G (binary multiples)
+bool parseRateOption(const std::string& value, std::uint64_t& result) {
+    size_t digits = 0;
+    while (digits < value.size() && std::isdigit(static_cast<unsigned char>(value[digits]))) {
+        ++digits;
+    }
+    std::string suffix = value.substr(digits);
+    int shift = 0;
+    if (suffix == "K" || suffix == "k") {
+        shift = 10;
+    } else if (suffix == "M" || suffix == "m") {
+        shift = 20;
+    } else if (suffix == "G" || suffix == "g") {
+        shift = 30;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    if (digits == 0 || digits > 9) {
+        return false;
+    }
+    result = std::stoull(value.substr(0, digits)) << shift;
+    return result > 0;
+}
+
+// Lowers the CPU (--nice) and I/O (--ioprio) scheduling priority of the
+// whole run. Applied before any worker starts, so every thread inherits it.
+bool applySchedulingPriority(int niceLevel, const std::string& ioClass, std::string& error) {
+#ifndef _WIN32
+    if (niceLevel > 0 && setpriority(PRIO_PROCESS, 0, niceLevel) != 0) {
+        error = std::string("cannot set nice level: ") + std::strerror(errno);
+        return false;
+    }
+#else
+    if (niceLevel > 0) {
+        error = "--nice is not supported on Windows yet";
+        return false;
+    }
+#endif
+    if (ioClass.empty()) {
+        return true;
+    }
+#ifdef __linux__
+    // ioprio_set(2): class in the top bits, level 0 (highest) to 7 below it
+    const int classShift = 13;
+    const int bestEffort = 2;
+    const int idle = 3;
+    int priority = 0;
+    if (ioClass == "idle") {
+        priority = idle << classShift;
+    } else if (ioClass.size() == 4 && ioClass.compare(0, 3, "be:") == 0 && ioClass[3] >= '0' && ioClass[3] <= '7') {
+        priority = bestEffort << classShift | (ioClass[3] - '0');
+    } else {
+        error = "--ioprio expects idle or be:0 to be:7";
+        return false;
+    }
+    const int whoProcess = 1;
+    if (syscall(SYS_ioprio_set, whoProcess, 0, priority) != 0) {
+        error = std::string("cannot set I/O priority: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    error = "--ioprio is only supported on Linux";
+    return false;
+#endif
+}
+
+#ifndef FILEORGANIZER_NO_MAIN
 int main(int argc, char* argv[]) {
+    // Output is flushed at explicit points (progress, summaries, prompts
+    // through the tied std::cin) rather than after every line
+    std::setvbuf(stdout, nullptr, _IOFBF, 1 << 16);
     SimpleFileOrganizer organizer;
     
     if (argc == 1) {
@@ -629,33 +7947,256 @@ int main(int argc, char* argv[]) {
     
     std::string command = argv[1];
     
+    // Separate option flags from positional arguments (folder, session ID)
+    OrganizerOptions options;
+    std::vector<std::string> args;
+    StatsMode statsMode = StatsMode::off;
+    std::string tracePath;
+    std::unique_ptr<RecordStream> records;
+    bool jobsGiven = false;
+    int maxOps = 0;
+    std::uint64_t maxBandwidth = 0;
+    int niceLevel = 0;
+    std::string ioClass;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output" || arg.rfind("--output=", 0) == 0) {
+            std::string format = arg.size() > 8 ? arg.substr(9) : (i + 1 < argc ? argv[++i] : "");
+            RecordStream::Format recordFormat;
+            if (format == "text") {
+                records.reset();
+            } else if (RecordStream::parseFormat(format, recordFormat)) {
+                records = std::make_unique<RecordStream>(recordFormat, stdout);
+            } else {
+                std::cout << "Error: --output expects text, ndjson or binary." << std::endl;
+                return 1;
+            }
+        } else if (arg == "--jobs") {
+            if (i + 1 >= argc || !parseCountOption(argv[i + 1], options.jobs)) {
+                std::cout << "Error: --jobs expects a number of worker threads." << std::endl;
+                return 1;
+            }
+            jobsGiven = true;
+            ++i;
+        } else if (arg == "--write-ahead") {
+            options.writeAhead = true;
+        } else if (arg == "--fsync") {
+            std::string policy = (i + 1 < argc) ? argv[i + 1] : "";
+            if (policy == "never") {
+                options.fsyncPolicy = FsyncPolicy::never;
+            } else if (policy == "batch") {
+                options.fsyncPolicy = FsyncPolicy::batch;
+            } else if (policy == "session") {
+                options.fsyncPolicy = FsyncPolicy::session;
+            } else {
+                std::cout << "Error: --fsync expects never, batch or session." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "--io-uring") {
+            options.ioUring = true;
+        } else if (arg == "--sniff") {
+            options.sniff = true;
+        } else if (arg == "--dedupe") {
+            std::string mode = (i + 1 < argc) ? argv[i + 1] : "";
+            if (mode == "link") {
+                options.dedupe = DedupeMode::link;
+            } else if (mode == "skip") {
+                options.dedupe = DedupeMode::skip;
+            } else {
+                std::cout << "Error: --dedupe expects link or skip." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "--recursive") {
+            options.recursive = true;
+        } else if (arg == "--stats") {
+            statsMode = StatsMode::text;
+        } else if (arg == "--stats-json") {
+            statsMode = StatsMode::json;
+        } else if (arg == "--trace") {
+            if (i + 1 >= argc) {
+                std::cout << "Error: --trace expects an output file." << std::endl;
+                return 1;
+            }
+            tracePath = argv[++i];
+        } else if (arg == "--max-ops") {
+            if (i + 1 >= argc || !parseCountOption(argv[i + 1], maxOps) || maxOps == 0) {
+                std::cout << "Error: --max-ops expects a number of file operations per second." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "--max-bandwidth") {
+            if (i + 1 >= argc || !parseRateOption(argv[i + 1], maxBandwidth)) {
+                std::cout << "Error: --max-bandwidth expects bytes per second, e.g. 500K, 20M or 1G." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "--nice") {
+            if (i + 1 >= argc || !parseCountOption(argv[i + 1], niceLevel) || niceLevel > 19) {
+                std::cout << "Error: --nice expects a level from 0 to 19." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "--ioprio") {
+            if (i + 1 >= argc) {
+                std::cout << "Error: --ioprio expects idle or be:0 to be:7." << std::endl;
+                return 1;
+            }
+            ioClass = argv[++i];
+        } else if (arg == "--layout") {
+            std::string layout = (i + 1 < argc) ? argv[i + 1] : "";
+            if (layout == "flat") {
+                options.layout = FolderLayout::flat;
+            } else if (layout == "date") {
+                options.layout = FolderLayout::date;
+            } else {
+                std::cout << "Error: --layout expects flat or date." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "--target") {
+            if (i + 1 >= argc) {
+                std::cout << "Error: --target expects a folder." << std::endl;
+                return 1;
+            }
+            options.targetRoot = argv[++i];
+        } else if (arg == "--rules") {
+            if (i + 1 >= argc) {
+                std::cout << "Error: --rules expects a rules file." << std::endl;
+                return 1;
+            }
+            options.rulesFile = argv[++i];
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (!organizer.setOptions(options)) {
+        return 1;
+    }
+    std::string priorityError;
+    if (!applySchedulingPriority(niceLevel, ioClass, priorityError)) {
+        std::cout << "Error: " << priorityError << "." << std::endl;
+        return 1;
+    }
+    IoThrottle::limit(maxOps, static_cast<double>(maxBandwidth));
+    if (statsMode != StatsMode::off || !tracePath.empty()) {
+        RunStats::enable(!tracePath.empty());
+    }
+    // With records on stdout, the remaining text (headers, summaries,
+    // errors) moves to stderr
+    std::ostream& text = records ? std::clog : std::cout;
+    if (records) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        organizer.setOutput(text, false);
+        organizer.setObserver(records.get());
+    }
+    
+    int exitCode = 0;
     if (command == "--help") {
         showHelp();
     }
     else if (command == "--interactive") {
         interactiveMode();
     }
-    else if (command == "--organize" && argc >= 3) {
-        std::string folderPath = argv[2];
+    else if (command == "--organize" && args.size() >= 1) {
+        std::string folderPath = args[0];
         organizer.organizeFolder(folderPath);
     }
-    else if (command == "--list" && argc >= 3) {
-        std::string folderPath = argv[2];
+    else if (command == "--list" && args.size() >= 1) {
+        std::string folderPath = args[0];
         organizer.listFiles(folderPath);
     }
-    else if (command == "--undo" && argc >= 3) {
-        std::string folderPath = argv[2];
-        std::string sessionId = (argc >= 4) ? argv[3] : "";
+    else if (command == "--undo" && args.size() >= 1) {
+        std::string folderPath = args[0];
+        std::string sessionId = (args.size() >= 2) ? args[1] : "";
         organizer.undoOrganization(folderPath, sessionId);
     }
-    else if (command == "--history" && argc >= 3) {
-        std::string folderPath = argv[2];
+    else if (command == "--history" && args.size() >= 1) {
+        std::string folderPath = args[0];
         organizer.showUndoHistory(folderPath);
     }
+    else if (command == "--watch" && args.size() >= 1) {
+        std::string folderPath = args[0];
+        organizer.watchFolder(folderPath);
+    }
+    else if (command == "--convert-log" && args.size() >= 1) {
+        std::string folderPath = args[0];
+        organizer.convertUndoLog(folderPath);
+    }
+    else if (command == "--batch" && args.size() >= 1) {
+        // Roots come from a file, or from stdin for "-"
+        std::vector<std::string> roots;
+        if (args[0] == "-") {
+            roots = BatchOrganizer::readRoots(std::cin);
+        } else {
+            std::ifstream list(args[0]);
+            if (!list) {
+                text << "Error: cannot read folder list " << args[0] << std::endl;
+                return 1;
+            }
+            roots = BatchOrganizer::readRoots(list);
+        }
+        // The pool defaults to one worker per core rather than --jobs 1
+        OrganizerOptions batchOptions = options;
+        if (!jobsGiven) {
+            batchOptions.jobs = 0;
+        }
+        BatchOrganizer batch(batchOptions, organizer.ruleSet(), text, records.get());
+        if (batch.run(roots) > 0) {
+            exitCode = 1;
+        }
+    }
+    else if (command == "--plan" && args.size() >= 2) {
+        MovePlan plan;
+        plan.folder = args[0];
+        plan.targetRoot = options.targetRoot.empty() ? plan.folder : options.targetRoot;
+        if (!organizer.planFolder(plan.folder, plan.paths, plan.moves)) {
+            exitCode = 1;
+        } else if (!plan.save(args[1])) {
+            text << "Error: cannot write plan " << args[1] << std::endl;
+            exitCode = 1;
+        } else {
+            text << "Plan written to: " << args[1] << '\n';
+            text << "To apply: --apply-plan \"" << args[1] << "\"" << std::endl;
+        }
+    }
+    else if (command == "--apply-plan" && args.size() >= 1) {
+        MovePlan plan;
+        std::string error;
+        if (!plan.load(args[0], error)) {
+            text << "Error: " << error << std::endl;
+            return 1;
+        }
+        organizer.applyPlan(plan.folder, plan.moves);
+    }
+    else if (command == "--serve" && args.size() >= 1) {
+#ifndef _WIN32
+        RpcServer server(options, organizer.ruleSet());
+        return server.run(args[0]) ? 0 : 1;
+#else
+        std::cout << "Error: --serve is not supported on Windows yet." << std::endl;
+        return 1;
+#endif
+    }
     else {
         std::cout << "Invalid arguments. Use --help for usage information." << std::endl;
         return 1;
     }
     
-    return 0;
+    if (records) {
+        records->flush();
+    }
+    if (statsMode == StatsMode::text) {
+        RunStats::report(text);
+    } else if (statsMode == StatsMode::json) {
+        RunStats::reportJson(text);
+    }
+    if (!tracePath.empty() && !RunStats::writeTrace(tracePath)) {
+        text << "Warning: could not write trace to " << tracePath << std::endl;
+    }
+    return exitCode;
 }
+#endif
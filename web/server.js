@@ -2,8 +2,131 @@ const http = require("http");
 const fs = require("fs");
 const path = require("path");
 const { spawn } = require("child_process");
+const net = require("net");
+const os = require("os");
 const url = require("url");
 
+// Talks JSON-RPC to a long-lived `FileOrganizer --serve` process, so web
+// requests do not pay for a process start each time. The daemon listens on
+// a Unix socket in a private temporary directory, which only this user can
+// connect to.
+class DaemonClient {
+    constructor(executablePath) {
+        this.executablePath = executablePath;
+        this.socketDir = null;
+        this.socketPath = null;
+        this.socket = null;
+        this.nextId = 1;
+        this.pending = new Map();
+        this.buffer = "";
+    }
+
+    start() {
+        if (process.platform === "win32") {
+            return Promise.resolve(false);
+        }
+        this.socketDir = fs.mkdtempSync(path.join(os.tmpdir(), "fileorganizer-"));
+        this.socketPath = path.join(this.socketDir, "daemon.sock");
+        return new Promise((resolve) => {
+            const daemon = spawn(
+                this.executablePath,
+                ["--serve", this.socketPath],
+                { stdio: ["ignore", "pipe", "pipe"] }
+            );
+            this.process = daemon;
+
+            daemon.stdout.once("data", (data) => {
+                if (!data.toString().startsWith("Listening")) {
+                    resolve(false);
+                    return;
+                }
+                this.socket = net.connect(this.socketPath, () =>
+                    resolve(true)
+                );
+                this.socket.on("data", (chunk) => this.onData(chunk));
+                this.socket.on("error", () => resolve(false));
+                this.socket.on("close", () => this.failAll("Daemon closed"));
+            });
+            daemon.on("error", () => resolve(false));
+            daemon.on("exit", () => {
+                this.socket = null;
+                this.failAll("Daemon exited");
+                resolve(false);
+            });
+        });
+    }
+
+    get ready() {
+        return this.socket !== null;
+    }
+
+    call(method, params, onProgress) {
+        return new Promise((resolve, reject) => {
+            const id = this.nextId++;
+            this.pending.set(id, { resolve, reject, onProgress });
+            this.socket.write(
+                JSON.stringify({ jsonrpc: "2.0", id, method, params }) + "\n"
+            );
+        });
+    }
+
+    onData(chunk) {
+        this.buffer += chunk.toString();
+        let newline;
+        while ((newline = this.buffer.indexOf("\n")) >= 0) {
+            const line = this.buffer.slice(0, newline);
+            this.buffer = this.buffer.slice(newline + 1);
+            let message;
+            try {
+                message = JSON.parse(line);
+            } catch (error) {
+                console.error("Ignoring malformed daemon reply:", line);
+                continue;
+            }
+
+            if (message.method === "progress" && message.params) {
+                const request = this.pending.get(message.params.id);
+                if (request && request.onProgress) {
+                    request.onProgress(message.params);
+                }
+                continue;
+            }
+
+            const request = this.pending.get(message.id);
+            if (!request) {
+                continue;
+            }
+            this.pending.delete(message.id);
+            if (message.error) {
+                request.reject({ message: message.error.message, output: "" });
+            } else {
+                request.resolve(message.result);
+            }
+        }
+    }
+
+    failAll(reason) {
+        for (const request of this.pending.values()) {
+            request.reject({ message: reason, output: "" });
+        }
+        this.pending.clear();
+    }
+
+    stop() {
+        if (this.process) {
+            this.process.kill();
+        }
+        if (this.socketDir) {
+            try {
+                fs.rmdirSync(this.socketDir, { recursive: true });
+            } catch (error) {
+                // Already gone
+            }
+            this.socketDir = null;
+        }
+    }
+}
+
 class FileOrganizerServer {
     constructor() {
         this.port = 3000;
@@ -26,7 +149,14 @@ class FileOrganizerServer {
         }
     }
 
-    start() {
+    async start() {
+        // Prefer the persistent daemon; fall back to one process per request
+        this.daemon = new DaemonClient(this.executablePath);
+        if (!(await this.daemon.start())) {
+            console.log("⚠️  FileOrganizer daemon unavailable, running one process per request");
+            this.daemon = null;
+        }
+
         const server = http.createServer((req, res) => {
             this.handleRequest(req, res);
         });
@@ -189,6 +319,17 @@ class FileOrganizerServer {
                     return;
             }
 
+            if (this.daemon && this.daemon.ready) {
+                const methods = { preview: "list", organize: "organize", history: "history", undo: "undo" };
+                const params = { folder: folderPath };
+                if (sessionId) {
+                    params.session = sessionId;
+                }
+                const result = await this.daemon.call(methods[endpoint], params);
+                this.sendJson(res, { success: true, output: result.output, result });
+                return;
+            }
+
             const result = await this.runFileOrganizer(args);
             this.sendJson(res, { success: true, output: result.output });
         } catch (error) {
@@ -272,6 +413,12 @@ class FileOrganizerServer {
 }
 
 // Handle graceful shutdown
+process.on("exit", () => {
+    if (server.daemon) {
+        server.daemon.stop();
+    }
+});
+
 process.on("SIGINT", () => {
     console.log("\n🛑 Shutting down FileOrganizer Web Interface...");
     console.log("👋 Goodbye!");